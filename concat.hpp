@@ -12,8 +12,45 @@
 
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <string>
 #include <tuple>
 #include <utility>
+#include <iterator>
+#include <memory>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <clocale>
+#include <cmath>
+#include <vector>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef __GLIBCXX__ // the characters of a libstdc++ stringbuf can be read through its put and get pointers
+#define THEYPSILON_CONCAT_STRINGBUF_IN_PLACE
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define THEYPSILON_CONCAT_POSIX
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 namespace theypsilon { // rename this to something that fits your code
 
@@ -36,6 +73,189 @@ namespace theypsilon { // rename this to something that fits your code
         constexpr char plus [] = " + ";
     };
 
+    struct roundtrip_t { // this class shouldn't be explicitly invoked in client code, use "roundtrip" instead
+        bool enabled;
+
+        static int index() { // the ios_base::iword slot that holds the mode in host streams
+            static const int i = std::ios_base::xalloc();
+            return i;
+        }
+
+        template <typename CharT, typename Traits>
+        friend std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>& out, roundtrip_t r) {
+            out.iword(index()) = r.enabled;
+            return out;
+        }
+    };
+
+    // manipulators: floating point values after "roundtrip" are written with the shortest text that reads back
+    // to the same value, ignoring the stream precision, until "noroundtrip" is found
+    constexpr roundtrip_t roundtrip  {true };
+    constexpr roundtrip_t noroundtrip{false};
+
+    enum class escape_mode : long { none, json, csv };
+
+    struct escape_t { // this class shouldn't be explicitly invoked in client code, use "escape::json" instead
+        escape_mode mode;
+        char        delimiter; // csv fields that contain it are quoted
+
+        static int index() { // the ios_base::iword slot that holds the mode in host streams
+            static const int i = std::ios_base::xalloc();
+            return i;
+        }
+
+        long to_word() const { return long(mode) | long((unsigned char)delimiter) << 8; }
+        static escape_t from_word(long word) { return escape_t{escape_mode(word & 0xff), char(word >> 8)}; }
+
+        template <typename CharT, typename Traits>
+        friend std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>& out, escape_t e) {
+            out.iword(index()) = e.to_word();
+            return out;
+        }
+    };
+
+    // manipulators: the text of the parameters after "escape::json" is written as the content of a JSON string,
+    // and after "escape::csv" (or "escape::tsv") as a RFC 4180 field, until "escape::none" is found. Separators
+    // are written as they are
+    namespace escape {
+        constexpr escape_t none{escape_mode::none, '\0' };
+        constexpr escape_t json{escape_mode::json, '\0' };
+        constexpr escape_t csv {escape_mode::csv,  ','  };
+        constexpr escape_t tsv {escape_mode::csv,  '\t'};
+    }
+
+    template <std::size_t N, typename CharT = char>
+    class fixed_string { // result of concat_n, keeps up to N characters inline and flags anything that didn't fit
+        CharT       buffer[N + 1] = {};
+        std::size_t length        = 0;
+        bool        overflow      = false;
+
+    public:
+        typedef CharT value_type;
+
+        const CharT* data()      const noexcept { return buffer; }
+        const CharT* c_str()     const noexcept { return buffer; }
+        std::size_t  size()      const noexcept { return length; }
+        bool         empty()     const noexcept { return length == 0; }
+        bool         truncated() const noexcept { return overflow; }
+        static constexpr std::size_t capacity() noexcept { return N; }
+
+        std::basic_string<CharT> str() const { return std::basic_string<CharT>(buffer, length); }
+
+        void push_back(CharT c) noexcept {
+            if (length < N) {
+                buffer[length++] = c;
+                buffer[length]   = CharT();
+            }
+            else overflow = true;
+        }
+
+        void append(const CharT* s, std::size_t n) noexcept {
+            if (n > N - length) {
+                n = N - length;
+                overflow = true;
+            }
+            std::char_traits<CharT>::copy(buffer + length, s, n);
+            buffer[length += n] = CharT();
+        }
+
+        // only shrinks. The truncated flag is set to the given one, so a rollback can restore it
+        void resize(std::size_t n, bool truncated = false) noexcept {
+            if (n < length) buffer[length = n] = CharT();
+            overflow = truncated;
+        }
+
+        friend std::basic_ostream<CharT>& operator<<(std::basic_ostream<CharT>& out, const fixed_string& s) {
+            return out.write(s.data(), s.size());
+        }
+    };
+
+    template <std::size_t N, typename CharT = char>
+    class constant_string { // result of concat_c, a literal type that holds the N characters of a compile-time text
+        CharT text[N + 1];
+
+    public:
+        typedef CharT value_type;
+
+        constexpr constant_string() : text{} {}
+
+        template <typename... C>
+        constexpr explicit constant_string(CharT first, C... rest) : text{first, CharT(rest)..., CharT()} {
+            static_assert(sizeof...(C) + 1 == N, "constant_string needs exactly N characters");
+        }
+
+        constexpr const CharT* data()  const noexcept { return text; }
+        constexpr const CharT* c_str() const noexcept { return text; }
+        constexpr std::size_t  size()  const noexcept { return N; }
+        constexpr bool         empty() const noexcept { return N == 0; }
+        constexpr CharT operator[](std::size_t i) const { return text[i]; }
+
+        std::basic_string<CharT> str() const { return std::basic_string<CharT>(text, N); }
+
+        friend std::basic_ostream<CharT>& operator<<(std::basic_ostream<CharT>& out, const constant_string& s) {
+            return out.write(s.data(), s.size());
+        }
+    };
+
+    template <typename CharT = char>
+    class string_ref { // token of split, a view of characters that live somewhere else
+        const CharT* text   = nullptr;
+        std::size_t  length = 0;
+
+    public:
+        typedef CharT value_type;
+
+        constexpr string_ref() noexcept {}
+        constexpr string_ref(const CharT* s, std::size_t n) noexcept : text(s), length(n) {}
+        string_ref(const CharT* s) noexcept : text(s), length(s ? std::char_traits<CharT>::length(s) : 0) {}
+
+        template <typename Traits, typename Alloc>
+        string_ref(const std::basic_string<CharT, Traits, Alloc>& s) noexcept : text(s.data()), length(s.size()) {}
+
+        constexpr const CharT* data()  const noexcept { return text; }
+        constexpr std::size_t  size()  const noexcept { return length; }
+        constexpr bool         empty() const noexcept { return length == 0; }
+        constexpr CharT operator[](std::size_t i) const { return text[i]; }
+
+        std::basic_string<CharT> str() const { return std::basic_string<CharT>(text, length); }
+
+        friend bool operator==(string_ref a, string_ref b) noexcept {
+            return a.length == b.length && std::char_traits<CharT>::compare(a.text, b.text, a.length) == 0;
+        }
+        friend bool operator!=(string_ref a, string_ref b) noexcept { return !(a == b); }
+
+        friend std::basic_ostream<CharT>& operator<<(std::basic_ostream<CharT>& out, const string_ref& s) {
+            return out.write(s.data(), s.size());
+        }
+    };
+
+    template <typename T>
+    class parallel_range { // this class shouldn't be explicitly invoked in client code, use "parallel" instead
+    public:
+        typedef typename std::decay<T>::type range_type;
+
+    private:
+        T         range; // a reference for lvalues, the range itself for temporaries
+        unsigned  threads;
+
+    public:
+        template <typename R>
+        parallel_range(R&& range, unsigned threads) : range(std::forward<R>(range)), threads(threads) {}
+
+        const range_type& base() const { return range; }
+        unsigned thread_count()  const { return threads ? threads : std::max(1u, std::thread::hardware_concurrency()); }
+
+        auto begin() const -> decltype(std::begin(std::declval<const range_type&>())) { return std::begin(range); }
+        auto end()   const -> decltype(std::end  (std::declval<const range_type&>())) { return std::end  (range); }
+    };
+
+    // the elements of a large container are formatted in chunks on several threads, with the same output
+    // as the serial join. "threads" defaults to the hardware concurrency. Temporaries are moved into the result
+    template <typename T>
+    parallel_range<T> parallel(T&& range, unsigned threads = 0) {
+        return parallel_range<T>(std::forward<T>(range), threads);
+    }
+
     namespace { // type helpers and traits
         template<typename T, typename CharT>
         struct is_writable_stream : std::integral_constant<bool,
@@ -106,9 +326,14 @@ namespace theypsilon { // rename this to something that fits your code
             std::is_same<T, decltype(std::setiosflags  (std::declval<std::ios::fmtflags>()))>::value ||
             std::is_same<T, decltype(std::resetiosflags(std::declval<std::ios::fmtflags>()))>::value>{};
 
+        template <typename T>
+        struct is_concat_manipulator : std::integral_constant<bool,
+            std::is_same<T, roundtrip_t>::value ||
+            std::is_same<T, escape_t   >::value>{};
+
         template <typename CharT, typename T>
         struct is_manipulator : std::integral_constant<bool,
-            (std::is_function<T>::value || is_parametrized_manipulator<CharT, T>::value)
+            (std::is_function<T>::value || is_parametrized_manipulator<CharT, T>::value || is_concat_manipulator<T>::value)
             && does_overload_ostream<CharT, T>::value>{};
 
         template <typename T, template <typename...> class Template>
@@ -119,182 +344,3567 @@ namespace theypsilon { // rename this to something that fits your code
 
         template <bool B, class T = void>
         using enable_if_t = typename std::enable_if<B, T>::type;
+
+        template <typename T>
+        struct is_character : std::integral_constant<bool,
+            std::is_same<T, char         >::value ||
+            std::is_same<T, signed char  >::value ||
+            std::is_same<T, unsigned char>::value ||
+            std::is_same<T, wchar_t      >::value ||
+            std::is_same<T, char16_t     >::value ||
+            std::is_same<T, char32_t     >::value>{};
+
+        template <typename CharT, typename T>
+        struct is_char_of : std::integral_constant<bool,
+            std::is_same<T, CharT>::value ||
+            (std::is_same<CharT, char>::value && (std::is_same<T, signed char  >::value ||
+                                                  std::is_same<T, unsigned char>::value))>{};
+
+        template <typename T>
+        struct is_utf_char : std::integral_constant<bool,
+            std::is_same<T, char    >::value ||
+            std::is_same<T, wchar_t >::value ||
+            std::is_same<T, char16_t>::value ||
+            std::is_same<T, char32_t>::value>{};
+
+        // strings and cstrings of another UTF char type, they are transcoded to CharT
+        template <typename CharT, typename T>
+        struct is_foreign_text : std::integral_constant<bool,
+            std::is_pointer<typename std::decay<T>::type>::value &&
+            is_utf_char<CharT>::value &&
+            is_utf_char<typename std::remove_cv<typename std::remove_pointer<typename std::decay<T>::type>::type>::type>::value &&
+            !std::is_same<CharT, typename std::remove_cv<typename std::remove_pointer<typename std::decay<T>::type>::type>::type>::value>{};
+
+        template <typename CharT, typename C, typename Traits, typename Alloc>
+        struct is_foreign_text<CharT, std::basic_string<C, Traits, Alloc>> : std::integral_constant<bool,
+            is_utf_char<CharT>::value && is_utf_char<C>::value && !std::is_same<CharT, C>::value>{};
+
+        template <typename CharT, typename T>
+        struct is_string_of : std::false_type {};
+
+        template <typename CharT, typename Traits, typename Alloc>
+        struct is_string_of<CharT, std::basic_string<CharT, Traits, Alloc>> : std::true_type {};
+
+        template <typename CharT, std::size_t N>
+        struct is_string_of<CharT, fixed_string<N, CharT>> : std::true_type {};
+
+        template <typename CharT, std::size_t N>
+        struct is_string_of<CharT, constant_string<N, CharT>> : std::true_type {};
+
+        template <typename CharT>
+        struct is_string_of<CharT, string_ref<CharT>> : std::true_type {};
+
+        template <char head, char... tail>
+        struct char_separator { // separator given as a char-pack, its text lives in static storage
+            static constexpr char        value[] = {head, tail..., '\0'};
+            static constexpr std::size_t size    = sizeof...(tail) + 1;
+        };
+
+        template <char head, char... tail>
+        constexpr char char_separator<head, tail...>::value[];
+
+        template <char head, char... tail>
+        constexpr std::size_t char_separator<head, tail...>::size;
+
+        struct can_append_impl {
+            template<typename B, typename C, typename A = decltype(std::declval<B&>().append(std::declval<const C*>(),
+                                                                                            std::declval<std::size_t>()))>
+            static std::true_type  test(int);
+            template<typename...>
+            static std::false_type test(...);
+        };
+
+        template<typename B, typename CharT>
+        struct can_append : public decltype(can_append_impl::test<B, CharT>(0)) {};
+
+        struct can_insert_range_impl {
+            template<typename B, typename C, typename I = decltype(std::declval<B&>().insert(std::declval<B&>().end(),
+                                                                                            std::declval<const C*>(),
+                                                                                            std::declval<const C*>()))>
+            static std::true_type  test(int);
+            template<typename...>
+            static std::false_type test(...);
+        };
+
+        template<typename B, typename CharT>
+        struct can_insert_range : public decltype(can_insert_range_impl::test<B, CharT>(0)) {};
+
+        struct can_reserve_impl {
+            template<typename B, typename R = decltype(std::declval<B&>().reserve(std::declval<B&>().capacity()))>
+            static std::true_type  test(int);
+            template<typename...>
+            static std::false_type test(...);
+        };
+
+        template<typename B>
+        struct can_reserve : public decltype(can_reserve_impl::test<B>(0)) {};
+
+        struct can_append_ref_impl {
+            template<typename B, typename C, typename A = decltype(std::declval<B&>().append_ref(std::declval<const C*>(),
+                                                                                                std::declval<std::size_t>()))>
+            static std::true_type  test(int);
+            template<typename...>
+            static std::false_type test(...);
+        };
+
+        template<typename B, typename CharT>
+        struct can_append_ref : public decltype(can_append_ref_impl::test<B, CharT>(0)) {};
+
+        struct can_stop_impl {
+            template<typename B, typename S = decltype(std::declval<const B&>().stopped())>
+            static std::true_type  test(int);
+            template<typename...>
+            static std::false_type test(...);
+        };
+
+        template<typename B>
+        struct can_stop : public decltype(can_stop_impl::test<B>(0)) {};
+
+        struct can_truncate_impl {
+            template<typename B, typename T = decltype(std::declval<const B&>().truncated())>
+            static std::true_type  test(int);
+            template<typename...>
+            static std::false_type test(...);
+        };
+
+        template<typename B>
+        struct can_truncate : public decltype(can_truncate_impl::test<B>(0)) {};
+
+        template <typename T>
+        struct is_sink : std::integral_constant<bool,
+#ifdef THEYPSILON_CONCAT_POSIX
+            std::is_same<T, int>::value ||
+#endif
+            std::is_same<T, std::FILE*>::value>{};
+
+        template <std::size_t... I>
+        struct index_sequence { typedef index_sequence type; };
+
+        template <typename A, typename B>
+        struct join_index_sequence;
+
+        template <std::size_t... I, std::size_t... J>
+        struct join_index_sequence<index_sequence<I...>, index_sequence<J...>> : index_sequence<I..., sizeof...(I) + J...> {};
+
+        // halves N on each step, so long literals (see concat_c) don't reach the template depth limit
+        template <std::size_t N>
+        struct make_index_sequence : join_index_sequence<typename make_index_sequence<N / 2    >::type,
+                                                         typename make_index_sequence<N - N / 2>::type> {};
+
+        template <>
+        struct make_index_sequence<0> : index_sequence<> {};
+
+        template <>
+        struct make_index_sequence<1> : index_sequence<0> {};
     }
 
-    namespace { // concat_impl : stringstream to string helper, separator handlers, and parameter writer functions
+    namespace { // buffer helpers : the operations string_writer needs from the container it appends to
 
-        template <typename CharT, typename W>
-        std::basic_string<CharT> concat_to_string(const W& writer) {
-            return writer.good() ? writer.str() : std::basic_string<CharT>();
+        template <typename B, typename CharT>
+            enable_if_t<can_append<B, CharT>::value,
+        void> append_chars(B& out, const CharT* s, std::size_t n) {
+            out.append(s, n);
         }
 
-        template <typename CharT, char head, char... tail>
-        std::basic_string<CharT> get_separator() { return {head, tail...}; }
+        template <typename B, typename CharT>
+            enable_if_t<!can_append<B, CharT>::value && can_insert_range<B, CharT>::value,
+        void> append_chars(B& out, const CharT* s, std::size_t n) {
+            out.insert(out.end(), s, s + n);
+        }
 
-        template <typename W, typename S>
-        void separate(W& writer, const S* separator) {
-            if (separator) writer << separator;
+        template <typename B, typename CharT>
+            enable_if_t<!can_append<B, CharT>::value && !can_insert_range<B, CharT>::value,
+        void> append_chars(B& out, const CharT* s, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) out.push_back(s[i]);
         }
 
-        template <typename W, typename S>
-        void separate(W& writer, const S& separator) {
-            writer << separator;
+        // text that stays alive until the buffer is consumed, like the parameters of the call, may be referenced
+        // instead of copied by the buffers that support it
+        template <typename B, typename CharT>
+            enable_if_t<can_append_ref<B, CharT>::value,
+        void> append_lasting(B& out, const CharT* s, std::size_t n) {
+            out.append_ref(s, n);
         }
 
-        template <typename CharT, typename T, typename W, typename S>
-        void concat_impl_write_separator(W& writer, const S& separator) {
-            if (!is_manipulator<CharT, T>::value) separate(writer, separator);
+        template <typename B, typename CharT>
+            enable_if_t<!can_append_ref<B, CharT>::value,
+        void> append_lasting(B& out, const CharT* s, std::size_t n) {
+            append_chars(out, s, n);
         }
 
-        template <typename CharT, typename W, typename S, typename... Args>
-        void concat_impl_write_element(W&, const S&, const std::tuple<Args...>&);
+        // buffers that flag the text they cut, like fixed_string, get the flag back when a failed call is rolled back
+        template <typename B>
+            enable_if_t<can_truncate<B>::value,
+        bool> buffer_truncated(const B& out) {
+            return out.truncated();
+        }
 
-        template <typename CharT, typename W, typename S, typename P1, typename P2>
-        void concat_impl_write_element(W&, const S&, const std::pair<P1, P2>&);
+        template <typename B>
+            enable_if_t<!can_truncate<B>::value,
+        bool> buffer_truncated(const B&) {
+            return false;
+        }
 
-        // we have 6 base cases, depending of the parameter type:
-        // 1. base case any type compatible with << that doesn't require a special handling
-        template <typename CharT, typename W, typename S, typename T>
-            enable_if_t<!is_iterable<T>::value && !is_stringstream<T>::value,
-        void> concat_impl_write_element(W& writer, const S&, const T& element) {
-            writer << element;
+        template <typename B>
+            enable_if_t<can_truncate<B>::value,
+        void> buffer_rollback(B& out, std::size_t n, bool truncated) {
+            out.resize(n, truncated);
         }
 
-        // 2. base case for fundamental built-in string types (const CharT* family, a.k.a. cstrings)
-        template <typename CharT, typename W, typename S, typename T>
-            enable_if_t<is_char_sequence<T*>::value,
-        void> concat_impl_write_element(W& writer, const S&, const T* element) {
-            if (element) writer << element;
+        template <typename B>
+            enable_if_t<!can_truncate<B>::value,
+        void> buffer_rollback(B& out, std::size_t n, bool) {
+            out.resize(n);
         }
 
-        // 3. base case for std::stringstream types
-        template <typename CharT, typename W, typename S, typename T>
-            enable_if_t<is_stringstream<T>::value,
-        void> concat_impl_write_element(W& writer, const S&, const T& element) {
-            if (element.good()) writer << concat_to_string<CharT>(element);
-            else writer.setstate(element.rdstate());
+        // buffers that already know the outcome, like the one of concat_equals after a mismatch, stop the writer
+        template <typename B>
+            enable_if_t<can_stop<B>::value,
+        bool> buffer_stopped(const B& out) {
+            return out.stopped();
         }
 
-        // 4. base case for containers, arrays, and any iterable type EXCEPT the standard string types
-        template <typename CharT, typename W, typename S, typename T>
-            enable_if_t<is_iterable<T>::value,
-        void> concat_impl_write_element(W& writer, const S& separator, const T& container) {
-            auto it = std::begin(container), et = std::end(container);
-            while(it != et) {
-                concat_impl_write_element<CharT>(writer, separator, *it);
-                if (++it != et) concat_impl_write_separator<CharT, T>(writer, separator);
-            }
+        template <typename B>
+            enable_if_t<!can_stop<B>::value,
+        bool> buffer_stopped(const B&) {
+            return false;
         }
 
-        // 5. base case for std::tuples
-        template<unsigned N, unsigned Last>
-        struct tuple_printer {
-            template<typename CharT, typename W, typename S, typename T>
-            static void print(W& writer, const S& separator, const T& tuple) {
-                concat_impl_write_element<CharT>(writer, separator, std::get<N>(tuple));
-                concat_impl_write_separator<CharT, T>(writer, separator);
-                tuple_printer<N + 1, Last>::template print<CharT>(writer, separator, tuple);
+        template <typename CharT>
+        class gather_buffer { // a list of segments: long texts of the parameters, and a scratch area for everything else
+        public:
+            static constexpr std::size_t max_segments  = 32;
+
+        private:
+            static constexpr std::size_t min_reference = 512; // shorter texts are cheaper to copy than to write apart
+            static constexpr std::size_t local_scratch = 1024;
+
+            struct segment {
+                const CharT* text;   // null for the text in the scratch area
+                std::size_t  offset; // in the scratch area
+                std::size_t  length;
+            };
+
+            segment                   segments[max_segments];
+            std::size_t               count  = 0;
+            std::size_t               length = 0;
+            CharT                     local[local_scratch];
+            std::size_t               used   = 0;
+            std::basic_string<CharT>  spill; // the scratch area, once it outgrows local
+
+            const CharT* scratch() const { return spill.empty() ? local : spill.data(); }
+
+        public:
+            typedef CharT value_type;
+
+            gather_buffer() = default;
+            gather_buffer(const gather_buffer&) = delete;
+
+            std::size_t size() const { return length; }
+
+            void push_back(CharT c) {
+                if (!count || segments[count - 1].text || !spill.empty() || used == local_scratch) return append(&c, 1);
+                local[used++] = c;
+                length++;
+                segments[count - 1].length++;
             }
-        };
 
-        template<unsigned N>
-        struct tuple_printer<N, N> {
-            template<typename CharT, typename W, typename S, typename T>
-            static void print(W& writer, const S& separator, const T& tuple) {
-                concat_impl_write_element<CharT>(writer, separator, std::get<N>(tuple));
+            void append(const CharT* s, std::size_t n) {
+                if (!n) return;
+                if (count == 0 || segments[count - 1].text) {
+                    if (count == max_segments) return append_ref(s, n); // there is no room left for another segment
+                    segments[count++] = segment{nullptr, used, 0};
+                }
+                if (spill.empty() && used + n <= local_scratch) std::char_traits<CharT>::copy(local + used, s, n);
+                else {
+                    if (spill.empty()) spill.assign(local, used);
+                    spill.append(s, n);
+                }
+                used += n;
+                length += n;
+                segments[count - 1].length += n;
             }
-        };
 
-        template <typename CharT, typename W, typename S, typename... Args>
-        inline void concat_impl_write_element(W& writer, const S& separator, const std::tuple<Args...>& tuple) {
-            tuple_printer<0, sizeof...(Args) - 1>::template print<CharT>(writer, separator, tuple);
-        }
+            void append_ref(const CharT* s, std::size_t n) {
+                if (n < min_reference || count == max_segments) {
+                    if (count < max_segments || !segments[count - 1].text) return append(s, n);
+                    // all segments are taken and the last one is a reference, so the scratch area can't grow
+                    // at the end. The referenced text is moved to the scratch area first
+                    const segment last = segments[--count];
+                    length -= last.length;
+                    append(last.text, last.length);
+                    return append(s, n);
+                }
+                segments[count++] = segment{s, 0, n};
+                length += n;
+            }
 
-        // 6. base case for std::pairs
-        template <typename CharT, typename W, typename S, typename P1, typename P2>
-        inline void concat_impl_write_element(W& writer, const S& separator, const std::pair<P1, P2>& pair) {
-            concat_impl_write_element<CharT>(writer, separator, pair.first);
-            concat_impl_write_separator<CharT, std::pair<P1, P2>>(writer, separator);
-            concat_impl_write_element<CharT>(writer, separator, pair.second);
-        }
+            void resize(std::size_t n) { // only shrinks, after a parameter failed
+                while (count && length > n) {
+                    segment& last = segments[count - 1];
+                    const std::size_t cut = std::min(last.length, length - n);
+                    last.length -= cut;
+                    length      -= cut;
+                    if (!last.text) {
+                        used = last.offset + last.length;
+                        if (!spill.empty()) spill.resize(used);
+                    }
+                    if (!last.length) count--;
+                }
+            }
 
-        // the following function is the recursive step that unpacks all the variadic parameters
-        template <typename CharT, typename W, typename S, typename T, typename... Args>
-        void concat_impl_write_element(W& writer, const S& separator, const T& head, const Args&... tail) {
-            concat_impl_write_element<CharT>(writer, separator, head);
-            concat_impl_write_separator<CharT, T>(writer, separator);
-            concat_impl_write_element<CharT>(writer, separator, tail...);
-        }
+            template <typename F>
+            void for_each(F f) const {
+                for (std::size_t i = 0; i < count; i++) {
+                    const segment& s = segments[i];
+                    f(s.text ? s.text : scratch() + s.offset, s.length);
+                }
+            }
+        };
 
-        // rearranges the parameters in order to prepare the recursive calls
-        template <typename CharT, typename S, typename T, typename... Args,
-            typename = enable_if_t<is_writable_stream<T, CharT>::value, T>>
-        std::basic_string<CharT> concat_impl(const S& separator, T& writer, const Args&... seq) {
-            concat_impl_write_element<CharT>(writer, separator, seq...);
-            return concat_to_string<CharT>(writer);
-        }
+        template <typename CharT>
+        constexpr std::size_t gather_buffer<CharT>::max_segments;
 
-        // when the first parameter is not a stringstream non-const reference, this defines the writer stream
-        template <typename CharT, typename S, typename... Args>
-        std::basic_string<CharT> concat_impl(const S& separator, const Args&... seq) {
-            std::basic_ostringstream<CharT> writer;
-            return concat_impl<CharT>(separator, writer, seq...);
-        }
-    }
+        template <typename CharT>
+        constexpr std::size_t gather_buffer<CharT>::min_reference;
 
-    // the 5 entry points:
-    // 1. entry point,  when received a separator as first element
-    template <typename CharT = char, typename... Args>
-    std::basic_string<CharT> concat(const separator_t<CharT>& sep, Args&&... seq) {
-        return concat_impl<CharT>(
-            sep.sep,
-            std::forward<Args>(seq)...
-        );
-    }
+        template <typename CharT>
+        constexpr std::size_t gather_buffer<CharT>::local_scratch;
 
-    // 2. entry point,  when the separator es specified via templated char-pack arguments
-    template <char head, char... tail, typename F, typename... Args,
-        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
-    std::basic_string<char> concat(F&& first, Args&&... rest) {
-        return concat_impl<char>(
-            get_separator<char, head, tail...>(),
-            std::forward<F>(first),
-            std::forward<Args>(rest)...
-        );
-    }
+        template <typename CharT>
+        class counting_buffer { // stores nothing, only counts what would be appended
+            std::size_t length = 0;
 
-    // 3. entry point, when the separator is a template argument of compile-time defined const char*
-    template <const char* sep, typename F, typename... Args,
-        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
-    std::basic_string<char> concat(F&& first, Args&&... rest) {
-        return concat_impl<char>(
-            sep,
-            std::forward<F>(first),
-            std::forward<Args>(rest)...
-        );
-    }
+        public:
+            typedef CharT value_type;
+
+            std::size_t size() const { return length; }
+            void push_back(CharT) { length++; }
+            void append(const CharT*, std::size_t n) { length += n; }
+            void resize(std::size_t n) { length = n; }
+        };
+
+        class xxh64 { // streaming XXH64 (Yann Collet) with seed 0, of the bytes in memory order
+            static constexpr std::uint64_t prime1 = 11400714785074694791ULL;
+            static constexpr std::uint64_t prime2 = 14029467366897019727ULL;
+            static constexpr std::uint64_t prime3 =  1609587929392839161ULL;
+            static constexpr std::uint64_t prime4 =  9650029242287828579ULL;
+            static constexpr std::uint64_t prime5 =  2870177450012600261ULL;
+
+            std::uint64_t lanes[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+            unsigned char stash[32];     // the bytes that don't fill a stripe yet
+            std::size_t   stashed = 0;
+            std::uint64_t total   = 0;
+
+            static std::uint64_t rotl(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+            static std::uint64_t read64(const unsigned char* p) {
+                std::uint64_t value;
+                std::memcpy(&value, p, sizeof(value));
+                return value;
+            }
+
+            static std::uint64_t read32(const unsigned char* p) {
+                std::uint32_t value;
+                std::memcpy(&value, p, sizeof(value));
+                return value;
+            }
+
+            static std::uint64_t round(std::uint64_t lane, std::uint64_t input) {
+                return rotl(lane + input * prime2, 31) * prime1;
+            }
+
+            static std::uint64_t merge(std::uint64_t hash, std::uint64_t lane) {
+                return (hash ^ round(0, lane)) * prime1 + prime4;
+            }
+
+            void stripe(const unsigned char* p) {
+                lanes[0] = round(lanes[0], read64(p));
+                lanes[1] = round(lanes[1], read64(p + 8));
+                lanes[2] = round(lanes[2], read64(p + 16));
+                lanes[3] = round(lanes[3], read64(p + 24));
+            }
+
+        public:
+            void update(const void* data, std::size_t n) {
+                const unsigned char* p = static_cast<const unsigned char*>(data);
+                total += n;
+                if (stashed + n < sizeof(stash)) {
+                    std::memcpy(stash + stashed, p, n);
+                    stashed += n;
+                    return;
+                }
+                if (stashed) {
+                    const std::size_t fill = sizeof(stash) - stashed;
+                    std::memcpy(stash + stashed, p, fill);
+                    stripe(stash);
+                    p += fill;
+                    n -= fill;
+                }
+                for (; n >= sizeof(stash); p += sizeof(stash), n -= sizeof(stash)) stripe(p);
+                std::memcpy(stash, p, n);
+                stashed = n;
+            }
+
+            std::uint64_t digest() const {
+                std::uint64_t hash = total < sizeof(stash) ? lanes[2] + prime5
+                                   : merge(merge(merge(merge(rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12)
+                                                             + rotl(lanes[3], 18), lanes[0]), lanes[1]), lanes[2]), lanes[3]);
+                hash += total;
+
+                const unsigned char* p = stash;
+                std::size_t          n = stashed;
+                for (; n >= 8; p += 8, n -= 8) hash = rotl(hash ^ round(0, read64(p)), 27) * prime1 + prime4;
+                if (n >= 4) {
+                    hash = rotl(hash ^ read32(p) * prime1, 23) * prime2 + prime3;
+                    p += 4;
+                    n -= 4;
+                }
+                for (; n; p++, n--) hash = rotl(hash ^ *p * prime5, 11) * prime1;
+
+                hash ^= hash >> 33;
+                hash *= prime2;
+                hash ^= hash >> 29;
+                hash *= prime3;
+                hash ^= hash >> 32;
+                return hash;
+            }
+        };
+
+        template <typename CharT>
+        class hashing_buffer { // stores nothing, hashes what would be appended
+            xxh64       hasher;
+            std::size_t length = 0;
+
+        public:
+            typedef CharT value_type;
+
+            std::size_t   size()   const { return length; }
+            std::uint64_t digest() const { return hasher.digest(); }
+
+            void push_back(CharT c) { append(&c, 1); }
+
+            void append(const CharT* s, std::size_t n) {
+                hasher.update(s, n * sizeof(CharT));
+                length += n;
+            }
+
+            void resize(std::size_t n) { // only back to empty, after a parameter failed
+                if (n < length) *this = hashing_buffer();
+            }
+        };
+
+        template <typename CharT>
+        class comparing_buffer { // stores nothing, compares what would be appended with a candidate text
+            const CharT* text;
+            std::size_t  length;
+            std::size_t  position = 0;
+            bool         differs  = false;
+
+        public:
+            typedef CharT value_type;
+
+            comparing_buffer(const CharT* s, std::size_t n) : text(s), length(n) {}
+
+            std::size_t size()    const { return position; }
+            bool        stopped() const { return differs; }
+            bool        equal()   const { return !differs && position == length; }
+
+            void push_back(CharT c) {
+                if (position < length && text[position] == c) position++;
+                else differs = true;
+            }
+
+            void append(const CharT* s, std::size_t n) {
+                if (n > length - position || std::char_traits<CharT>::compare(text + position, s, n) != 0) differs = true;
+                else position += n;
+            }
+
+            void resize(std::size_t n) { position = n; } // only shrinks, after a parameter failed
+        };
+
+        template <typename CharT>
+        struct stringbuf_access : std::basic_streambuf<CharT> { // reaches the protected pointers of any streambuf
+            typedef std::basic_streambuf<CharT> streambuf;
+            typedef std::pair<const CharT*, const CharT*> range;
+
+            // the characters a stringbuf returns from str(), without copying them
+            static range contents(const streambuf* buffer) {
+                CharT* (streambuf::*eback)() const = &stringbuf_access::eback;
+                CharT* (streambuf::*egptr)() const = &stringbuf_access::egptr;
+                CharT* (streambuf::*pbase)() const = &stringbuf_access::pbase;
+                CharT* (streambuf::*pptr )() const = &stringbuf_access::pptr;
+
+                const CharT* get_end = (buffer->*egptr)();
+                const CharT* put     = (buffer->*pptr)();
+                if (!put) return range((buffer->*eback)(), get_end);
+                return range((buffer->*pbase)(), get_end && get_end > put ? get_end : put);
+            }
+
+            // the characters written since the put area was last rewound
+            static range written(const streambuf* buffer) {
+                CharT* (streambuf::*pbase)() const = &stringbuf_access::pbase;
+                CharT* (streambuf::*pptr )() const = &stringbuf_access::pptr;
+                return range((buffer->*pbase)(), (buffer->*pptr)());
+            }
+
+            // the characters the put area can hold before it grows
+            static std::size_t capacity(const streambuf* buffer) {
+                CharT* (streambuf::*pbase)() const = &stringbuf_access::pbase;
+                CharT* (streambuf::*epptr)() const = &stringbuf_access::epptr;
+                return (buffer->*epptr)() - (buffer->*pbase)();
+            }
+        };
+
+        // the characters a stringbuf returns from str(). Other libraries (like libc++) keep a private high-water
+        // mark, which is only reachable through str(), so there they are copied
+        template <typename CharT>
+        class stringbuf_text {
+#ifndef THEYPSILON_CONCAT_STRINGBUF_IN_PLACE
+            const std::basic_string<CharT> copy;
+#endif
+
+        public:
+            const CharT* first;
+            const CharT* second;
+
+#ifdef THEYPSILON_CONCAT_STRINGBUF_IN_PLACE
+            static constexpr bool in_place = true;
+
+            explicit stringbuf_text(const std::basic_stringbuf<CharT>* buffer) {
+                const auto text = stringbuf_access<CharT>::contents(buffer);
+                first  = text.first;
+                second = text.second;
+            }
+#else
+            static constexpr bool in_place = false;
+
+            explicit stringbuf_text(const std::basic_stringbuf<CharT>* buffer)
+                : copy(buffer->str()), first(copy.data()), second(copy.data() + copy.size()) {}
+#endif
+
+            stringbuf_text(const stringbuf_text&) = delete;
+
+            std::size_t size() const { return second - first; }
+        };
+
+        // grows geometrically, so appending repeatedly to the same buffer never reallocates on every call
+        template <typename B>
+        void reserve_more(B& out, std::size_t n) {
+            if (out.size() + n > out.capacity()) out.reserve(std::max(out.size() + n, 2 * out.capacity()));
+        }
+
+        template <typename B>
+            enable_if_t<can_reserve<B>::value,
+        void> buffer_reserve(B& out, std::size_t n) {
+            reserve_more(out, n);
+        }
+
+        template <typename B>
+            enable_if_t<!can_reserve<B>::value,
+        void> buffer_reserve(B&, std::size_t) {}
+    }
+
+    namespace { // number formatting : integers, and floating point values with the default stream flags
+
+        template <typename T>
+        enable_if_t< std::is_signed<T>::value, bool> is_negative(T value) { return value < 0; }
+
+        template <typename T>
+        enable_if_t<!std::is_signed<T>::value, bool> is_negative(T) { return false; }
+
+        template <typename = void>
+        struct decimal_digits {
+            static constexpr char pairs[201] =
+                "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                "8081828384858687888990919293949596979899";
+        };
+
+        template <typename T>
+        constexpr char decimal_digits<T>::pairs[];
+
+        // writes the decimal digits of value backwards, ending right before end, two digits at a time
+        template <typename CharT, typename U>
+        CharT* write_decimal(CharT* end, U value) {
+            typedef typename std::conditional<(sizeof(U) < sizeof(unsigned)), unsigned, U>::type W;
+            const char* pairs = decimal_digits<>::pairs;
+            W rest = value;
+            while (rest >= 100) {
+                const std::size_t i = std::size_t(rest % 100) * 2;
+                rest /= 100;
+                *--end = CharT(pairs[i + 1]);
+                *--end = CharT(pairs[i]);
+            }
+            if (rest >= 10) {
+                const std::size_t i = std::size_t(rest) * 2;
+                *--end = CharT(pairs[i + 1]);
+                *--end = CharT(pairs[i]);
+            } else {
+                *--end = CharT('0' + rest);
+            }
+            return end;
+        }
+
+        // the same text std::num_put writes for integers with default flags in the "C" locale
+        template <typename CharT, typename T>
+        CharT* write_integer(CharT* end, T value) {
+            typedef typename std::make_unsigned<T>::type U;
+            if (!is_negative(value)) return write_decimal(end, U(value));
+            CharT* begin = write_decimal(end, U(U(0) - U(value)));
+            *--begin = CharT('-');
+            return begin;
+        }
+
+        template <typename U>
+        std::size_t count_digits(U value) {
+            std::size_t digits = 1;
+            for (; value >= 10000; value /= 10000) digits += 4;
+            return digits + (value >= 10) + (value >= 100) + (value >= 1000);
+        }
+
+        template <typename T> // the exact length of the write_integer text
+        std::size_t integer_text_length(T value) {
+            typedef typename std::make_unsigned<T>::type U;
+            return is_negative(value) ? 1 + count_digits(U(U(0) - U(value))) : count_digits(U(value));
+        }
+
+        template <typename T> // enough room for write_integer
+        struct integer_length : std::integral_constant<std::size_t,
+            std::numeric_limits<typename std::make_unsigned<T>::type>::digits10 + 2>{};
+
+        // snprintf writes the decimal point of the C locale (LC_NUMERIC), the text of concat always has '.' like the
+        // "C" locale. buffer holds the length chars snprintf wrote, the result is the new length
+        inline int classic_decimal_point(char* buffer, int length) {
+            const char* const point = std::localeconv()->decimal_point;
+            if (length < 0 || (point[0] == '.' && point[1] == '\0')) return length;
+            char* const found = std::strstr(buffer, point);
+            if (!found || !*point) return length;
+            const std::size_t size = std::strlen(point);
+            *found = '.';
+            std::memmove(found + 1, found + size, buffer + length + 1 - (found + size));
+            return length - int(size - 1);
+        }
+
+        inline int format_floating(char* buffer, std::size_t size, double value) {
+            const int length = std::snprintf(buffer, size, "%.*g", 6, value);
+            return length < int(size) ? classic_decimal_point(buffer, length) : length;
+        }
+
+        inline int format_floating(char* buffer, std::size_t size, long double value) {
+            const int length = std::snprintf(buffer, size, "%.*Lg", 6, value);
+            return length < int(size) ? classic_decimal_point(buffer, length) : length;
+        }
+    }
+
+    namespace { // shortest round-trip floating point formatting, Grisu3 (Florian Loitsch, "Printing Floating-Point
+                // Numbers Quickly and Accurately with Integers") with an exact fallback for the values it rejects
+
+        struct diy_fp { // f * 2^e
+            std::uint64_t f;
+            int           e;
+
+            diy_fp operator-(const diy_fp& y) const { return {f - y.f, e}; }
+
+            diy_fp operator*(const diy_fp& y) const { // upper 64 bits of the 128-bit product, rounded
+                const std::uint64_t mask = 0xFFFFFFFFu;
+                const std::uint64_t a = f >> 32, b = f & mask, c = y.f >> 32, d = y.f & mask;
+                const std::uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+                const std::uint64_t mid = (bd >> 32) + (ad & mask) + (bc & mask) + (std::uint64_t{1} << 31);
+                return {ac + (ad >> 32) + (bc >> 32) + (mid >> 32), e + y.e + 64};
+            }
+
+            diy_fp normalized() const {
+                diy_fp x = *this;
+                while (!(x.f >> 63)) { x.f <<= 1; x.e--; }
+                return x;
+            }
+        };
+
+        struct cached_power { // 10^k, normalized
+            std::uint64_t f;
+            int           e;
+            int           k;
+        };
+
+        template <typename = void>
+        struct cached_powers {
+            static constexpr int          min_exponent = -300;
+            static constexpr int          step         = 8;
+            static constexpr cached_power table[79]    = {
+                { 0xAB70FE17C79AC6CA, -1060, -300 }, { 0xFF77B1FCBEBCDC4F, -1034, -292 },
+                { 0xBE5691EF416BD60C, -1007, -284 }, { 0x8DD01FAD907FFC3C,  -980, -276 },
+                { 0xD3515C2831559A83,  -954, -268 }, { 0x9D71AC8FADA6C9B5,  -927, -260 },
+                { 0xEA9C227723EE8BCB,  -901, -252 }, { 0xAECC49914078536D,  -874, -244 },
+                { 0x823C12795DB6CE57,  -847, -236 }, { 0xC21094364DFB5637,  -821, -228 },
+                { 0x9096EA6F3848984F,  -794, -220 }, { 0xD77485CB25823AC7,  -768, -212 },
+                { 0xA086CFCD97BF97F4,  -741, -204 }, { 0xEF340A98172AACE5,  -715, -196 },
+                { 0xB23867FB2A35B28E,  -688, -188 }, { 0x84C8D4DFD2C63F3B,  -661, -180 },
+                { 0xC5DD44271AD3CDBA,  -635, -172 }, { 0x936B9FCEBB25C996,  -608, -164 },
+                { 0xDBAC6C247D62A584,  -582, -156 }, { 0xA3AB66580D5FDAF6,  -555, -148 },
+                { 0xF3E2F893DEC3F126,  -529, -140 }, { 0xB5B5ADA8AAFF80B8,  -502, -132 },
+                { 0x87625F056C7C4A8B,  -475, -124 }, { 0xC9BCFF6034C13053,  -449, -116 },
+                { 0x964E858C91BA2655,  -422, -108 }, { 0xDFF9772470297EBD,  -396, -100 },
+                { 0xA6DFBD9FB8E5B88F,  -369,  -92 }, { 0xF8A95FCF88747D94,  -343,  -84 },
+                { 0xB94470938FA89BCF,  -316,  -76 }, { 0x8A08F0F8BF0F156B,  -289,  -68 },
+                { 0xCDB02555653131B6,  -263,  -60 }, { 0x993FE2C6D07B7FAC,  -236,  -52 },
+                { 0xE45C10C42A2B3B06,  -210,  -44 }, { 0xAA242499697392D3,  -183,  -36 },
+                { 0xFD87B5F28300CA0E,  -157,  -28 }, { 0xBCE5086492111AEB,  -130,  -20 },
+                { 0x8CBCCC096F5088CC,  -103,  -12 }, { 0xD1B71758E219652C,   -77,   -4 },
+                { 0x9C40000000000000,   -50,    4 }, { 0xE8D4A51000000000,   -24,   12 },
+                { 0xAD78EBC5AC620000,     3,   20 }, { 0x813F3978F8940984,    30,   28 },
+                { 0xC097CE7BC90715B3,    56,   36 }, { 0x8F7E32CE7BEA5C70,    83,   44 },
+                { 0xD5D238A4ABE98068,   109,   52 }, { 0x9F4F2726179A2245,   136,   60 },
+                { 0xED63A231D4C4FB27,   162,   68 }, { 0xB0DE65388CC8ADA8,   189,   76 },
+                { 0x83C7088E1AAB65DB,   216,   84 }, { 0xC45D1DF942711D9A,   242,   92 },
+                { 0x924D692CA61BE758,   269,  100 }, { 0xDA01EE641A708DEA,   295,  108 },
+                { 0xA26DA3999AEF774A,   322,  116 }, { 0xF209787BB47D6B85,   348,  124 },
+                { 0xB454E4A179DD1877,   375,  132 }, { 0x865B86925B9BC5C2,   402,  140 },
+                { 0xC83553C5C8965D3D,   428,  148 }, { 0x952AB45CFA97A0B3,   455,  156 },
+                { 0xDE469FBD99A05FE3,   481,  164 }, { 0xA59BC234DB398C25,   508,  172 },
+                { 0xF6C69A72A3989F5C,   534,  180 }, { 0xB7DCBF5354E9BECE,   561,  188 },
+                { 0x88FCF317F22241E2,   588,  196 }, { 0xCC20CE9BD35C78A5,   614,  204 },
+                { 0x98165AF37B2153DF,   641,  212 }, { 0xE2A0B5DC971F303A,   667,  220 },
+                { 0xA8D9D1535CE3B396,   694,  228 }, { 0xFB9B7CD9A4A7443C,   720,  236 },
+                { 0xBB764C4CA7A44410,   747,  244 }, { 0x8BAB8EEFB6409C1A,   774,  252 },
+                { 0xD01FEF10A657842C,   800,  260 }, { 0x9B10A4E5E9913129,   827,  268 },
+                { 0xE7109BFBA19C0C9D,   853,  276 }, { 0xAC2820D9623BF429,   880,  284 },
+                { 0x80444B5E7AA7CF85,   907,  292 }, { 0xBF21E44003ACDD2D,   933,  300 },
+                { 0x8E679C2F5E44FF8F,   960,  308 }, { 0xD433179D9C8CB841,   986,  316 },
+                { 0x9E19DB92B4E31BA9,  1013,  324 }
+            };
+
+            // a power c such that -60 <= c.e + e + 64 <= -32
+            static const cached_power& for_binary_exponent(int e) {
+                const int f = -60 - e - 1;
+                const int k = (f * 78913) / (1 << 18) + int(f > 0); // ceil(f * log10(2))
+                return table[(-min_exponent + k + (step - 1)) / step];
+            }
+        };
+
+        template <typename T> constexpr int          cached_powers<T>::min_exponent;
+        template <typename T> constexpr int          cached_powers<T>::step;
+        template <typename T> constexpr cached_power cached_powers<T>::table[79];
+
+        struct float_boundaries {
+            diy_fp w, minus, plus;
+        };
+
+        template <typename F> // value must be finite and positive
+        float_boundaries compute_boundaries(F value) {
+            typedef typename std::conditional<sizeof(F) == 4, std::uint32_t, std::uint64_t>::type bits_type;
+            constexpr int           precision = std::numeric_limits<F>::digits;
+            constexpr int           bias      = std::numeric_limits<F>::max_exponent - 1 + (precision - 1);
+            constexpr std::uint64_t hidden    = std::uint64_t{1} << (precision - 1);
+
+            bits_type bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            const std::uint64_t fraction = bits & (hidden - 1);
+            const int           exponent = int(bits >> (precision - 1));
+
+            const diy_fp v = exponent == 0 ? diy_fp{fraction, 1 - bias} : diy_fp{fraction + hidden, exponent - bias};
+            const bool lower_is_closer = fraction == 0 && exponent > 1;
+            const diy_fp plus  = diy_fp{2 * v.f + 1, v.e - 1}.normalized();
+            const diy_fp minus = lower_is_closer ? diy_fp{4 * v.f - 1, v.e - 2} : diy_fp{2 * v.f - 1, v.e - 1};
+            return {v.normalized(), {minus.f << (minus.e - plus.e), plus.e}, plus};
+        }
+
+        inline bool grisu3_round_weed(char* digits, int length, std::uint64_t distance_too_high_w,
+                                      std::uint64_t unsafe_interval, std::uint64_t rest, std::uint64_t ten_kappa,
+                                      std::uint64_t unit) {
+            const std::uint64_t small_distance = distance_too_high_w - unit;
+            const std::uint64_t big_distance   = distance_too_high_w + unit;
+            while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+                   (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+                digits[length - 1]--;
+                rest += ten_kappa;
+            }
+            if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+                (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+                return false;
+            }
+            return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+        }
+
+        // false when the digits can't be proven to be the shortest ones, which happens for ~0.5% of the values
+        inline bool grisu3_digit_gen(char* digits, int& length, int& exponent, diy_fp low, diy_fp w, diy_fp high) {
+            std::uint64_t unit = 1;
+            const diy_fp too_low{low.f - unit, low.e}, too_high{high.f + unit, high.e};
+            std::uint64_t unsafe_interval = (too_high - too_low).f;
+            const int           shift = -w.e;
+            const std::uint64_t one   = std::uint64_t{1} << shift;
+
+            std::uint32_t integral   = std::uint32_t(too_high.f >> shift);
+            std::uint64_t fractional = too_high.f & (one - 1);
+
+            std::uint32_t pow10 = 1;
+            int kappa = 1;
+            while (kappa < 10 && integral >= pow10 * 10) { pow10 *= 10; kappa++; }
+
+            length = 0;
+            while (kappa > 0) {
+                digits[length++] = char('0' + integral / pow10);
+                integral %= pow10;
+                kappa--;
+                const std::uint64_t rest = (std::uint64_t{integral} << shift) + fractional;
+                if (rest < unsafe_interval) {
+                    exponent += kappa;
+                    return grisu3_round_weed(digits, length, (too_high - w).f, unsafe_interval, rest,
+                                             std::uint64_t{pow10} << shift, unit);
+                }
+                pow10 /= 10;
+            }
+
+            for (;;) {
+                fractional      *= 10;
+                unit            *= 10;
+                unsafe_interval *= 10;
+                digits[length++] = char('0' + (fractional >> shift));
+                fractional &= one - 1;
+                kappa--;
+                if (fractional < unsafe_interval) {
+                    exponent += kappa;
+                    return grisu3_round_weed(digits, length, (too_high - w).f * unit, unsafe_interval, fractional,
+                                             one, unit);
+                }
+            }
+        }
+
+        // the slow but exact path for the values Grisu3 gives up on: the first precision that reads back
+        template <typename F>
+        void shortest_digits_fallback(char* digits, int& length, int& exponent, F value) {
+            char text[32];
+            for (int precision = 1; precision <= std::numeric_limits<F>::max_digits10; precision++) {
+                std::snprintf(text, sizeof(text), "%.*e", precision - 1, double(value));
+                const F parsed = std::is_same<F, float>::value ? F(std::strtof(text, nullptr)) : F(std::strtod(text, nullptr));
+                if (parsed == value) break;
+            }
+            classic_decimal_point(text, int(std::strlen(text)));
+            length = 0;
+            const char* c = text;
+            for (; *c != 'e'; c++) if (*c != '.') digits[length++] = *c;
+            exponent = std::atoi(c + 1) - (length - 1);
+        }
+
+        // digits * 10^exponent == value, with the fewest digits that read back to value
+        template <typename F>
+        void shortest_digits(char* digits, int& length, int& exponent, F value) {
+            const float_boundaries b = compute_boundaries(value);
+            const cached_power& c = cached_powers<>::for_binary_exponent(b.w.e);
+            const diy_fp power{c.f, c.e};
+            exponent = -c.k;
+            if (!grisu3_digit_gen(digits, length, exponent, b.minus * power, b.w * power, b.plus * power)) {
+                shortest_digits_fallback(digits, length, exponent, value);
+            }
+        }
+
+        // lays the digits out like "%g" does, switching to scientific notation when the decimal exponent
+        // is below -4 or above 16. Returns the length of the text, buffer needs room for 25 chars
+        template <typename F>
+        int format_shortest(char* buffer, F value) {
+            char* out = buffer;
+            if (std::signbit(value)) *out++ = '-';
+            value = std::fabs(value);
+            if (value == 0) {
+                *out++ = '0';
+                return int(out - buffer);
+            }
+
+            char digits[18];
+            int length, exponent;
+            shortest_digits(digits, length, exponent, value);
+            const int point = length + exponent; // digits are 0.d1d2d3... * 10^point
+
+            if (point > -4 && point <= 17) {
+                if (point <= 0) {
+                    *out++ = '0';
+                    *out++ = '.';
+                    for (int i = point; i < 0; i++) *out++ = '0';
+                    std::memcpy(out, digits, length);
+                    out += length;
+                } else if (point >= length) {
+                    std::memcpy(out, digits, length);
+                    out += length;
+                    for (int i = length; i < point; i++) *out++ = '0';
+                } else {
+                    std::memcpy(out, digits, point);
+                    out += point;
+                    *out++ = '.';
+                    std::memcpy(out, digits + point, length - point);
+                    out += length - point;
+                }
+                return int(out - buffer);
+            }
+
+            *out++ = digits[0];
+            if (length > 1) {
+                *out++ = '.';
+                std::memcpy(out, digits + 1, length - 1);
+                out += length - 1;
+            }
+            int scientific = point - 1;
+            *out++ = 'e';
+            *out++ = scientific < 0 ? '-' : '+';
+            if (scientific < 0) scientific = -scientific;
+            char exponent_digits[4];
+            char* const end = exponent_digits + 4;
+            char* begin = write_decimal(end, unsigned(scientific));
+            if (end - begin < 2) *--begin = '0';
+            std::memcpy(out, begin, end - begin);
+            return int(out + (end - begin) - buffer);
+        }
+
+        // long double has no fixed layout across platforms, so the shortest precision that reads back is searched
+        inline int format_shortest(char* buffer, long double value) {
+            int length = 0;
+            for (int precision = std::numeric_limits<long double>::digits10;
+                 precision <= std::numeric_limits<long double>::max_digits10; precision++) {
+                length = std::snprintf(buffer, 48, "%.*Lg", precision, value);
+                if (std::strtold(buffer, nullptr) == value) break;
+            }
+            return classic_decimal_point(buffer, length);
+        }
+    }
+
+    namespace { // utf transcoding : char is UTF-8, char16_t UTF-16, char32_t UTF-32, and wchar_t UTF-16 or UTF-32
+                // depending on its size. Invalid sequences become U+FFFD
+
+        template <std::size_t N>
+        using unit_size = std::integral_constant<std::size_t, N>;
+
+        template <typename C>
+        char32_t utf_decode(const C*& s, const C* end, unit_size<1>) {
+            const unsigned char lead = *s++;
+            if (lead < 0x80) return lead;
+            int trail;
+            char32_t code, lowest;
+            if      ((lead & 0xe0) == 0xc0) { trail = 1; code = lead & 0x1f; lowest = 0x80;    }
+            else if ((lead & 0xf0) == 0xe0) { trail = 2; code = lead & 0x0f; lowest = 0x800;   }
+            else if ((lead & 0xf8) == 0xf0) { trail = 3; code = lead & 0x07; lowest = 0x10000; }
+            else return 0xfffd;
+            for (; trail; trail--) { // a broken sequence ends before the unit that broke it
+                if (s == end || (*s & 0xc0) != 0x80) return 0xfffd;
+                code = (code << 6) | (*s++ & 0x3f);
+            }
+            if (code < lowest || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) return 0xfffd;
+            return code;
+        }
+
+        template <typename C>
+        char32_t utf_decode(const C*& s, const C* end, unit_size<2>) {
+            const char32_t unit = char16_t(*s++);
+            if (unit < 0xd800 || unit > 0xdfff) return unit;
+            if (unit <= 0xdbff && s != end && char16_t(*s) >= 0xdc00 && char16_t(*s) <= 0xdfff)
+                return 0x10000 + ((unit - 0xd800) << 10) + (char16_t(*s++) - 0xdc00);
+            return 0xfffd;
+        }
+
+        template <typename C>
+        char32_t utf_decode(const C*& s, const C*, unit_size<4>) {
+            const char32_t code = char32_t(*s++);
+            return code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff) ? 0xfffd : code;
+        }
+
+        template <typename CharT>
+        CharT* utf_encode(CharT* out, char32_t code, unit_size<1>) {
+            if (code < 0x80) {
+                *out++ = CharT(code);
+            } else if (code < 0x800) {
+                *out++ = CharT(0xc0 | (code >> 6));
+                *out++ = CharT(0x80 | (code & 0x3f));
+            } else if (code < 0x10000) {
+                *out++ = CharT(0xe0 | (code >> 12));
+                *out++ = CharT(0x80 | ((code >> 6) & 0x3f));
+                *out++ = CharT(0x80 | (code & 0x3f));
+            } else {
+                *out++ = CharT(0xf0 | (code >> 18));
+                *out++ = CharT(0x80 | ((code >> 12) & 0x3f));
+                *out++ = CharT(0x80 | ((code >> 6) & 0x3f));
+                *out++ = CharT(0x80 | (code & 0x3f));
+            }
+            return out;
+        }
+
+        template <typename CharT>
+        CharT* utf_encode(CharT* out, char32_t code, unit_size<2>) {
+            if (code < 0x10000) {
+                *out++ = CharT(code);
+            } else {
+                *out++ = CharT(0xd800 + ((code - 0x10000) >> 10));
+                *out++ = CharT(0xdc00 + ((code - 0x10000) & 0x3ff));
+            }
+            return out;
+        }
+
+        template <typename CharT>
+        CharT* utf_encode(CharT* out, char32_t code, unit_size<4>) {
+            *out++ = CharT(code);
+            return out;
+        }
+
+        // 16 ASCII units at once, nothing is written when one of them isn't ASCII
+        template <typename To, typename From, typename A, typename B>
+        bool utf_ascii_block(To*, const From*, A, B) { return false; }
+
+#ifdef __SSE2__
+        template <typename To, typename From>
+        bool utf_ascii_block(To* out, const From* s, unit_size<2>, unit_size<1>) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+            if (_mm_movemask_epi8(bytes)) return false;
+            const __m128i zero = _mm_setzero_si128();
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out),     _mm_unpacklo_epi8(bytes, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(bytes, zero));
+            return true;
+        }
+
+        template <typename To, typename From>
+        bool utf_ascii_block(To* out, const From* s, unit_size<4>, unit_size<1>) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+            if (_mm_movemask_epi8(bytes)) return false;
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i low  = _mm_unpacklo_epi8(bytes, zero);
+            const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out),      _mm_unpacklo_epi16(low,  zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4),  _mm_unpackhi_epi16(low,  zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8),  _mm_unpacklo_epi16(high, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(high, zero));
+            return true;
+        }
+
+        template <typename To, typename From>
+        bool utf_ascii_block(To* out, const From* s, unit_size<1>, unit_size<2>) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 8));
+            const __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(short(0xff80)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xffff) return false;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(a, b));
+            return true;
+        }
+
+        template <typename To, typename From>
+        bool utf_ascii_block(To* out, const From* s, unit_size<1>, unit_size<4>) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 4));
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 8));
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 12));
+            const __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)),
+                                               _mm_set1_epi32(int(0xffffff80)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xffff) return false;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                             _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+            return true;
+        }
+#endif
+
+        // the text is converted in chunks on the stack, and each chunk is handed to append
+        template <typename CharT, typename C, typename Append>
+        void utf_transcode(const C* s, std::size_t n, Append append) {
+            constexpr std::size_t chunk = 256, block = 16; // a block also leaves room for the 4 units of a code point
+            CharT buffer[chunk];
+            CharT* out = buffer;
+            const C* const end = s + n;
+            while (s != end) {
+                if (out > buffer + chunk - block) {
+                    append(buffer, out - buffer);
+                    out = buffer;
+                }
+                if (end - s >= std::ptrdiff_t(block) && utf_ascii_block(out, s, unit_size<sizeof(CharT)>(), unit_size<sizeof(C)>())) {
+                    s += block;
+                    out += block;
+                } else {
+                    out = utf_encode(out, utf_decode(s, end, unit_size<sizeof(C)>()), unit_size<sizeof(CharT)>());
+                }
+            }
+            if (out != buffer) append(buffer, out - buffer);
+        }
+
+        template <typename C, typename Traits, typename Alloc>
+        std::pair<const C*, std::size_t> foreign_text(const std::basic_string<C, Traits, Alloc>& s) {
+            return std::make_pair(s.data(), s.size());
+        }
+
+        template <typename C>
+        std::pair<const C*, std::size_t> foreign_text(const C* s) {
+            return std::make_pair(s, s ? std::char_traits<C>::length(s) : 0);
+        }
+
+        template <typename CharT, typename T>
+        std::basic_string<CharT> transcoded(const T& text) {
+            std::basic_string<CharT> result;
+            const auto source = foreign_text(text);
+            utf_transcode<CharT>(source.first, source.second, [&result](const CharT* s, std::size_t n) {
+                result.append(s, n);
+            });
+            return result;
+        }
+    }
+
+    namespace { // escaping : the text of the parameters written as the content of a JSON string, or as a CSV field
+
+        struct json_special { // quotes, backslashes and control characters
+            template <typename CharT>
+            bool operator()(CharT c) const {
+                return c == CharT('"') || c == CharT('\\') || typename std::make_unsigned<CharT>::type(c) < 0x20;
+            }
+#ifdef __SSE2__
+            __m128i operator()(__m128i bytes) const {
+                return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')),
+                                                 _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(0x1f)), bytes)); // bytes <= 0x1f
+            }
+#endif
+#ifdef __AVX2__
+            __m256i operator()(__m256i bytes) const {
+                return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"')),
+                                                       _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'))),
+                                       _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, _mm256_set1_epi8(0x1f)), bytes));
+            }
+#endif
+        };
+
+        struct csv_special { // the delimiter, quotes and line breaks
+            char delimiter;
+
+            template <typename CharT>
+            bool operator()(CharT c) const {
+                return c == CharT(delimiter) || c == CharT('"') || c == CharT('\n') || c == CharT('\r');
+            }
+#ifdef __SSE2__
+            __m128i operator()(__m128i bytes) const {
+                return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(delimiter)),
+                                                 _mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'))),
+                                    _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')),
+                                                 _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))));
+            }
+#endif
+#ifdef __AVX2__
+            __m256i operator()(__m256i bytes) const {
+                return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(delimiter)),
+                                                       _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'))),
+                                       _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')),
+                                                       _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r'))));
+            }
+#endif
+        };
+
+        struct char_special { // one character, like the quotes inside a csv field
+            char c;
+
+            template <typename CharT>
+            bool operator()(CharT x) const { return x == CharT(c); }
+#ifdef __SSE2__
+            __m128i operator()(__m128i bytes) const { return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)); }
+#endif
+#ifdef __AVX2__
+            __m256i operator()(__m256i bytes) const { return _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c)); }
+#endif
+        };
+
+        // the first character that matches, or end
+        template <typename CharT, typename Special>
+        const CharT* find_special(const CharT* s, const CharT* end, Special special) {
+            while (s != end && !special(*s)) s++;
+            return s;
+        }
+
+#ifdef __SSE2__
+        // clean spans are skipped 32 (AVX2) or 16 bytes at a time
+        template <typename Special>
+        const char* find_special(const char* s, const char* end, Special special) {
+#ifdef __AVX2__
+            for (; end - s >= 32; s += 32) {
+                const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+                if (const unsigned mask = unsigned(_mm256_movemask_epi8(special(bytes)))) return s + __builtin_ctz(mask);
+            }
+#endif
+            for (; end - s >= 16; s += 16) {
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+                if (const int mask = _mm_movemask_epi8(special(bytes))) return s + __builtin_ctz(mask);
+            }
+            while (s != end && !special(*s)) s++;
+            return s;
+        }
+#endif
+
+        template <typename CharT>
+        std::size_t json_escape_char(CharT c, CharT* out) {
+            static const char hex[] = "0123456789abcdef";
+            out[0] = CharT('\\');
+            switch (c) {
+                case CharT('"'):  out[1] = CharT('"');  return 2;
+                case CharT('\\'): out[1] = CharT('\\'); return 2;
+                case CharT('\b'): out[1] = CharT('b');  return 2;
+                case CharT('\f'): out[1] = CharT('f');  return 2;
+                case CharT('\n'): out[1] = CharT('n');  return 2;
+                case CharT('\r'): out[1] = CharT('r');  return 2;
+                case CharT('\t'): out[1] = CharT('t');  return 2;
+            }
+            out[1] = CharT('u');
+            out[2] = CharT('0');
+            out[3] = CharT('0');
+            out[4] = CharT(hex[(c >> 4) & 0xf]);
+            out[5] = CharT(hex[c & 0xf]);
+            return 6;
+        }
+
+        // clean spans are handed to append as they are, and each escaped character on its own
+        template <typename CharT, typename Append>
+        void json_escape(const CharT* s, std::size_t n, Append append) {
+            const CharT* const end = s + n;
+            for (;;) {
+                const CharT* const special = find_special(s, end, json_special());
+                if (special != s) append(s, special - s);
+                if (special == end) return;
+                CharT escaped[6];
+                append(escaped, json_escape_char(*special, escaped));
+                s = special + 1;
+            }
+        }
+
+        // the field is quoted when it has a special character. Nothing before the first one is a quote, so the
+        // rest of the field is only searched for quotes, which are doubled
+        template <typename CharT, typename Append>
+        void csv_quote(char delimiter, const CharT* s, std::size_t n, Append append) {
+            const CharT* const end = s + n;
+            const CharT* special = find_special(s, end, csv_special{delimiter});
+            if (special == end) return append(s, n);
+
+            static const CharT quotes[] = { CharT('"'), CharT('"') };
+            append(quotes, 1);
+            for (;;) {
+                special = find_special(special, end, char_special{'"'});
+                append(s, special - s);
+                if (special == end) break;
+                append(quotes, 2);
+                s = ++special;
+            }
+            append(quotes, 1);
+        }
+
+        // each call escapes one whole field, as csv needs to know where the field starts and ends
+        template <typename CharT, typename Append>
+        void escape_text(escape_t e, const CharT* s, std::size_t n, Append append) {
+            if (e.mode == escape_mode::json) json_escape(s, n, append);
+            else csv_quote(e.delimiter, s, n, append);
+        }
+    }
+
+    namespace { // string_writer : appends straight into a string, a stream is only built for types that need one
+
+        enum class write_as { character, c_str, string, foreign, boolean, integer, floating, manipulator, stream };
+
+        template <write_as K>
+        using write_tag = std::integral_constant<write_as, K>;
+
+        template <typename CharT, typename T>
+        struct write_category : write_tag<
+            is_char_of<CharT, T>::value                                             ? write_as::character   :
+            is_c_str<T, CharT>::value                                               ? write_as::c_str       :
+            is_string_of<CharT, T>::value                                           ? write_as::string      :
+            is_foreign_text<CharT, T>::value                                        ? write_as::foreign     :
+            std::is_same<T, bool>::value                                            ? write_as::boolean     :
+            std::is_integral<T>::value && !is_character<T>::value                   ? write_as::integer     :
+            std::is_floating_point<T>::value                                        ? write_as::floating    :
+            is_manipulator<CharT, typename std::remove_pointer<T>::type>::value     ? write_as::manipulator :
+                                                                                      write_as::stream>{};
+
+        // ranges whose elements string_writer joins without the per element dispatch: text and integers
+        template <typename CharT, typename T, // T must be iterable
+                  typename E = write_category<CharT, typename std::decay<decltype(*std::begin(std::declval<const T&>()))>::type>>
+        struct is_flat_range : std::integral_constant<bool,
+            E::value == write_as::c_str || E::value == write_as::string || E::value == write_as::integer>{};
+
+        template <typename CharT, typename T, typename E> // parallel ranges have their own join
+        struct is_flat_range<CharT, parallel_range<T>, E> : std::false_type {};
+
+        // building a stream copies the global locale and allocates, so each thread keeps the streams string_writer
+        // is done with. They are handed out again with the format of a new stream (the current global locale
+        // included) and an empty buffer
+        template <typename CharT>
+        class stream_pool {
+            typedef std::basic_ostringstream<CharT> stream_type;
+
+            static constexpr std::size_t max_streams = 8; // enough for writers nested in operator<<
+            static constexpr std::size_t max_buffer  = 4096; // larger buffers are freed, not kept for every thread
+
+            std::vector<std::unique_ptr<stream_type>> streams;
+            stream_type                               pristine;
+            // resetting the fill needs a ctype facet, which char16_t and char32_t don't have
+            const bool                                resettable = std::has_facet<std::ctype<CharT>>(pristine.getloc());
+
+        public:
+            static stream_pool& local() {
+                static thread_local stream_pool pool;
+                return pool;
+            }
+
+            std::unique_ptr<stream_type> acquire() {
+                if (streams.empty()) return std::unique_ptr<stream_type>(new stream_type());
+                std::unique_ptr<stream_type> stream = std::move(streams.back());
+                streams.pop_back();
+                const std::locale global; // std::locale::global may have been called since the stream was pooled
+                if (stream->getloc() != global) stream->imbue(global);
+                return stream;
+            }
+
+            bool reusable() const { return resettable; }
+
+            // str("") keeps the capacity of the stringbuf, so a stream that grew past max_buffer is dropped
+            void release(std::unique_ptr<stream_type> stream) {
+                if (!resettable || streams.size() == max_streams) return;
+                if (stringbuf_access<CharT>::capacity(stream->rdbuf()) > max_buffer) return;
+                const std::locale global;
+                if (pristine.getloc() != global) pristine.imbue(global);
+                stream->clear();
+                stream->copyfmt(pristine); // flags, precision, width, fill, locale, exceptions mask and iwords
+                stream->seekp(0);
+                streams.push_back(std::move(stream));
+            }
+        };
+
+        template <typename CharT>
+        constexpr std::size_t stream_pool<CharT>::max_streams;
+
+        template <typename CharT>
+        constexpr std::size_t stream_pool<CharT>::max_buffer;
+
+        // mimics the subset of std::basic_ostream used by concat_impl_write_element. Text, numbers and the
+        // default manipulators are written directly; anything else (user types, non-default format flags)
+        // goes through a lazily built stream whose output is moved into the string after each insertion
+        template <typename CharT, typename Buffer = std::basic_string<CharT>>
+        class string_writer {
+            typedef std::basic_ostringstream<CharT> stream_type;
+            typedef std::basic_ostream<CharT>& ostream_manipulator(std::basic_ostream<CharT>&);
+
+            Buffer&                       out;
+            std::unique_ptr<stream_type>  stream;
+            std::ios_base::iostate        state     = std::ios_base::goodbit;
+            bool                          formatted = false; // the stream holds non-default format flags
+            bool                          shortest  = false; // roundtrip mode
+            escape_t                      escaping  = escape::none;
+
+        public:
+            explicit string_writer(Buffer& out) : out(out) {}
+
+            ~string_writer() {
+                if (stream) stream_pool<CharT>::local().release(std::move(stream));
+            }
+
+            bool good() const { return state == std::ios_base::goodbit && !buffer_stopped(out); }
+            std::ios_base::iostate rdstate() const { return state; }
+            void setstate(std::ios_base::iostate s) { state |= s; }
+
+            template <typename T>
+            string_writer& operator<<(const T& value) {
+                if (good()) write(value, write_category<CharT, T>());
+                return *this;
+            }
+
+            void reserve(std::size_t n) { buffer_reserve(out, n); }
+
+            // text that isn't null-terminated and is copied, like the chunks of a parallel join (escaped when a mode is active)
+            void write_chars(const CharT* s, std::size_t n) {
+                if (!good()) return;
+                if (formatted) write_stream(std::basic_string<CharT>(s, s + n));
+                else append_text(s, n);
+            }
+
+            // text that isn't null-terminated and lives as long as the parameters, like the contents of a guest stream
+            void write_lasting(const CharT* s, std::size_t n) {
+                if (!good()) return;
+                if (formatted) write_stream(std::basic_string<CharT>(s, s + n));
+                else append_lasting_text(s, n);
+            }
+
+            // separators skip the formatting checks, they are always copied as they are
+            void write_separator(CharT c) {
+                if (good()) out.push_back(c);
+            }
+
+            void write_separator(const CharT* s, std::size_t n) {
+                if (good()) append_chars(out, s, n);
+            }
+
+            // nothing pending in the stream and nothing to escape, text can be copied as it is
+            bool plain() const { return good() && !formatted && escaping.mode == escape_mode::none; }
+
+            // starts with the format state of another writer, so both write the same text. Fails for streams
+            // without a ctype facet, as copying their fill throws
+            template <typename B>
+            bool copy_format(const string_writer<CharT, B>& other) {
+                shortest  = other.shortest;
+                formatted = other.formatted;
+                escaping  = other.escaping;
+                if (other.stream) {
+                    if (!stream_pool<CharT>::local().reusable()) return false;
+                    if (!stream) stream = stream_pool<CharT>::local().acquire();
+                    stream->copyfmt(*other.stream);
+                }
+                return true;
+            }
+
+            template <typename B>
+            bool same_format(const string_writer<CharT, B>& other) const {
+                return shortest == other.shortest && formatted == other.formatted && fill() == other.fill()
+                    && escaping.to_word() == other.escaping.to_word();
+            }
+
+            // joins a range of strings, cstrings or integers without the per element dispatch, the caller checks plain()
+            template <typename Range>
+            void write_join(const Range& range, const CharT* separator, std::size_t n) {
+                write_join(range, separator, n, is_specialization_of<Buffer, std::basic_string>());
+            }
+
+        private:
+            template <typename, typename>
+            friend class string_writer;
+
+            CharT fill() const { return stream && stream_pool<CharT>::local().reusable() ? stream->fill() : CharT(' '); }
+
+            void write(CharT c, write_tag<write_as::character>) {
+                if (formatted) write_stream(c);
+                else if (escaping.mode != escape_mode::none) append_text(&c, 1);
+                else out.push_back(c);
+            }
+
+            template <typename T>
+            void write(const T& c, write_tag<write_as::character>) {
+                write(static_cast<CharT>(c), write_tag<write_as::character>());
+            }
+
+            void write(const CharT* s, write_tag<write_as::c_str>) {
+                if (formatted || !s) write_stream(s);
+                else append_lasting_text(s, std::char_traits<CharT>::length(s));
+            }
+
+            template <typename T>
+            void write(const T& s, write_tag<write_as::string>) {
+                if (formatted) write_stream(s);
+                else append_lasting_text(s.data(), s.size());
+            }
+
+            template <typename T>
+            void write(const T& s, write_tag<write_as::foreign>) {
+                if (formatted) return write_stream(transcoded<CharT>(s));
+                if (escaping.mode == escape_mode::csv) { // the field is quoted as a whole
+                    const std::basic_string<CharT> text = transcoded<CharT>(s);
+                    return append_text(text.data(), text.size());
+                }
+                const auto text = foreign_text(s);
+                utf_transcode<CharT>(text.first, text.second, [this](const CharT* chunk, std::size_t n) {
+                    append_text(chunk, n);
+                });
+            }
+
+            void write(bool b, write_tag<write_as::boolean>) {
+                if (formatted) write_stream(b);
+                else out.push_back(b ? CharT('1') : CharT('0'));
+            }
+
+            template <typename T>
+            void write(const T& value, write_tag<write_as::integer>) {
+                if (formatted) return write_stream(value);
+                CharT digits[integer_length<T>::value];
+                CharT* const end = digits + integer_length<T>::value;
+                CharT* const begin = write_integer(end, value);
+                append_chars(out, begin, end - begin);
+            }
+
+            template <typename T>
+            void write(const T& value, write_tag<write_as::floating>) {
+                typedef typename std::conditional<std::is_same<T, long double>::value, long double, double>::type F;
+                char buffer[48];
+                if (shortest && std::isfinite(value)) {
+                    const int length = format_shortest(buffer, value);
+                    if (formatted) write_stream(std::basic_string<CharT>(buffer, buffer + length));
+                    else append_ascii(buffer, length);
+                    return;
+                }
+                const int length = formatted ? -1 : format_floating(buffer, sizeof(buffer), F(value));
+                if (length < 0 || length >= int(sizeof(buffer))) return write_stream(value);
+                append_ascii(buffer, length);
+            }
+
+            void write(const roundtrip_t& mode, write_tag<write_as::manipulator>) {
+                shortest = mode.enabled;
+            }
+
+            void write(const escape_t& e, write_tag<write_as::manipulator>) {
+                escaping = e;
+            }
+
+            // functions decay here too, the 5. entry point passes its separator as a pointer
+            void write(ostream_manipulator* manipulator, write_tag<write_as::manipulator>) {
+                if      (manipulator == &std::endl <CharT, std::char_traits<CharT>>) out.push_back(CharT('\n'));
+                else if (manipulator == &std::ends <CharT, std::char_traits<CharT>>) out.push_back(CharT());
+                else if (manipulator != &std::flush<CharT, std::char_traits<CharT>>) write_stream(manipulator);
+            }
+
+            template <typename T>
+            void write(const T& manipulator, write_tag<write_as::manipulator>) {
+                write_stream(manipulator);
+            }
+
+            template <typename T>
+            void write(const T& value, write_tag<write_as::stream>) {
+                write_stream(value);
+            }
+
+            // strings are grown once to the joined size and filled in place, every element is written
+            // straight into its final position
+            template <typename Range>
+            void write_join(const Range& range, const CharT* separator, std::size_t n, std::true_type) {
+                std::size_t size = 0, count = 0;
+                for (const auto& element : range) {
+                    size += element_length(element);
+                    count++;
+                }
+                if (!count) return;
+
+                const std::size_t position = out.size();
+                out.resize(position + size + (count - 1) * n);
+                CharT* p = &out[position];
+                bool first = true;
+                for (const auto& element : range) {
+                    if (!first) p = copy_chars(p, separator, n);
+                    p = copy_element(p, element, element_length(element));
+                    first = false;
+                }
+            }
+
+            template <typename Range>
+            void write_join(const Range& range, const CharT* separator, std::size_t n, std::false_type) {
+                auto it = std::begin(range), et = std::end(range);
+                if (it == et) return;
+                append_element(*it);
+                while (++it != et) {
+                    if (n) append_chars(out, separator, n);
+                    append_element(*it);
+                }
+            }
+
+            template <typename T>
+            static std::size_t element_length(const T& element) {
+                return element_length(element, write_category<CharT, T>());
+            }
+
+            // null cstrings are skipped, but still separated
+            static std::size_t element_length(const CharT* s, write_tag<write_as::c_str>) {
+                return s ? std::char_traits<CharT>::length(s) : 0;
+            }
+
+            template <typename T>
+            static std::size_t element_length(const T& s, write_tag<write_as::string>) { return s.size(); }
+
+            template <typename T>
+            static std::size_t element_length(T value, write_tag<write_as::integer>) { return integer_text_length(value); }
+
+            template <typename T>
+            static CharT* copy_element(CharT* p, const T& element, std::size_t n) {
+                return copy_element(p, element, n, write_category<CharT, T>());
+            }
+
+            static CharT* copy_element(CharT* p, const CharT* s, std::size_t n, write_tag<write_as::c_str>) {
+                return copy_chars(p, s, n);
+            }
+
+            template <typename T>
+            static CharT* copy_element(CharT* p, const T& s, std::size_t n, write_tag<write_as::string>) {
+                return copy_chars(p, s.data(), n);
+            }
+
+            template <typename T>
+            static CharT* copy_element(CharT* p, T value, std::size_t n, write_tag<write_as::integer>) {
+                write_integer(p + n, value);
+                return p + n;
+            }
+
+            static CharT* copy_chars(CharT* p, const CharT* s, std::size_t n) {
+                if (n) std::char_traits<CharT>::copy(p, s, n);
+                return p + n;
+            }
+
+            template <typename T>
+            void append_element(const T& element) {
+                append_element(element, write_category<CharT, T>());
+            }
+
+            void append_element(const CharT* s, write_tag<write_as::c_str>) {
+                if (s) append_lasting(out, s, std::char_traits<CharT>::length(s));
+            }
+
+            template <typename T>
+            void append_element(const T& s, write_tag<write_as::string>) {
+                if (s.size()) append_lasting(out, s.data(), s.size());
+            }
+
+            template <typename T>
+            void append_element(const T& value, write_tag<write_as::integer> tag) {
+                write(value, tag);
+            }
+
+            // the text of a parameter, escaped when an escape mode is active
+            void append_text(const CharT* s, std::size_t n) {
+                if (escaping.mode == escape_mode::none) return append_chars(out, s, n);
+                escape_text(escaping, s, n, [this](const CharT* span, std::size_t length) {
+                    append_chars(out, span, length);
+                });
+            }
+
+            // escaped text is always copied, it doesn't live anywhere else
+            void append_lasting_text(const CharT* s, std::size_t n) {
+                if (escaping.mode == escape_mode::none) append_lasting(out, s, n);
+                else append_text(s, n);
+            }
+
+            void append_ascii(const char* s, int n) {
+                for (int i = 0; i < n; i++) out.push_back(CharT(s[i]));
+            }
+
+            template <typename T>
+            void write_stream(const T& value) {
+                if (!stream) stream = stream_pool<CharT>::local().acquire();
+                *stream << value;
+                sync();
+            }
+
+            // the text is read in place and the put area rewound, so the stream buffer is reused by the next insertion
+            void sync() {
+                const auto text = stringbuf_access<CharT>::written(stream->rdbuf());
+                if (text.first != text.second) {
+                    append_text(text.first, text.second - text.first);
+                    stream->seekp(0);
+                }
+                state |= stream->rdstate();
+                formatted = stream->flags()     != (std::ios_base::skipws | std::ios_base::dec)
+                         || stream->precision() != 6
+                         || stream->width()     != 0;
+            }
+        };
+    }
+
+    namespace { // concat_impl_size : walks the parameters like concat_impl_write_element, but only measures them
+
+        // longest "%.6g" output: sign, 6 digits, point, and a signed exponent of up to 4 digits
+        constexpr std::size_t max_floating_length = 14;
+
+        template <typename CharT>
+        std::size_t concat_impl_size_value(CharT, write_tag<write_as::character>) { return 1; }
+
+        template <typename CharT>
+        std::size_t concat_impl_size_value(const CharT* s, write_tag<write_as::c_str>) {
+            return s ? std::char_traits<CharT>::length(s) : 0;
+        }
+
+        template <typename T>
+        std::size_t concat_impl_size_value(const T& s, write_tag<write_as::string>) { return s.size(); }
+
+        template <typename T> // exact for ASCII text
+        std::size_t concat_impl_size_value(const T& s, write_tag<write_as::foreign>) { return foreign_text(s).second; }
+
+        inline std::size_t concat_impl_size_value(bool, write_tag<write_as::boolean>) { return 1; }
+
+        template <typename T>
+        std::size_t concat_impl_size_value(const T& value, write_tag<write_as::integer>) {
+            return integer_text_length(value);
+        }
+
+        template <typename T>
+        std::size_t concat_impl_size_value(const T&, write_tag<write_as::floating>) { return max_floating_length; }
+
+        template <typename T, write_as K> // manipulators and user defined types can't be measured without writing them
+        std::size_t concat_impl_size_value(const T&, write_tag<K>) { return 0; }
+
+        template <typename S>
+        std::size_t separator_size(const S* separator) {
+            return separator ? std::char_traits<S>::length(separator) : 0;
+        }
+
+        template <char head, char... tail>
+        constexpr std::size_t separator_size(const char_separator<head, tail...>&) {
+            return char_separator<head, tail...>::size;
+        }
+
+        template <typename S>
+        std::size_t separator_size(const S&) { return 1; } // std::endl
+
+        template <typename CharT, typename T, typename S>
+        std::size_t concat_impl_size_separator(const S& separator) {
+            return is_manipulator<CharT, T>::value ? 0 : separator_size(separator);
+        }
+
+        template <typename CharT, typename S, typename... Args>
+        std::size_t concat_impl_size_element(const S&, const std::tuple<Args...>&);
+
+        template <typename CharT, typename S, typename P1, typename P2>
+        std::size_t concat_impl_size_element(const S&, const std::pair<P1, P2>&);
+
+        // parallel ranges are measured once their chunks are formatted, walking them here would be a serial pass
+        template <typename CharT, typename S, typename T>
+        std::size_t concat_impl_size_element(const S&, const parallel_range<T>&) { return 0; }
+
+        // the same 6 base cases of concat_impl_write_element
+        template <typename CharT, typename S, typename T>
+            enable_if_t<!is_iterable<T>::value && !is_stringstream<T>::value,
+        std::size_t> concat_impl_size_element(const S&, const T& element) {
+            return concat_impl_size_value(element, write_category<CharT, T>());
+        }
+
+        template <typename CharT, typename S, typename T>
+            enable_if_t<is_char_sequence<T*>::value,
+        std::size_t> concat_impl_size_element(const S&, const T* element) {
+            return concat_impl_size_value(element, write_category<CharT, const T*>());
+        }
+
+        template <typename CharT, typename S, typename T>
+            enable_if_t<is_stringstream<T>::value,
+        std::size_t> concat_impl_size_element(const S&, const T& element) {
+            if (!element.good()) return 0;
+            return stringbuf_text<typename T::char_type>(element.rdbuf()).size();
+        }
+
+        template <typename CharT, typename S, typename T>
+            enable_if_t<is_iterable<T>::value,
+        std::size_t> concat_impl_size_element(const S& separator, const T& container) {
+            std::size_t size = 0, count = 0;
+            for (const auto& element : container) {
+                size += concat_impl_size_element<CharT>(separator, element);
+                count++;
+            }
+            return count ? size + (count - 1) * concat_impl_size_separator<CharT, T>(separator) : 0;
+        }
+
+        template<unsigned N, unsigned Last>
+        struct tuple_measurer {
+            template<typename CharT, typename S, typename T>
+            static std::size_t measure(const S& separator, const T& tuple) {
+                return concat_impl_size_element<CharT>(separator, std::get<N>(tuple))
+                     + concat_impl_size_separator<CharT, T>(separator)
+                     + tuple_measurer<N + 1, Last>::template measure<CharT>(separator, tuple);
+            }
+        };
+
+        template<unsigned N>
+        struct tuple_measurer<N, N> {
+            template<typename CharT, typename S, typename T>
+            static std::size_t measure(const S& separator, const T& tuple) {
+                return concat_impl_size_element<CharT>(separator, std::get<N>(tuple));
+            }
+        };
+
+        template <typename CharT, typename S, typename... Args>
+        inline std::size_t concat_impl_size_element(const S& separator, const std::tuple<Args...>& tuple) {
+            return tuple_measurer<0, sizeof...(Args) - 1>::template measure<CharT>(separator, tuple);
+        }
+
+        template <typename CharT, typename S, typename P1, typename P2>
+        inline std::size_t concat_impl_size_element(const S& separator, const std::pair<P1, P2>& pair) {
+            return concat_impl_size_element<CharT>(separator, pair.first)
+                 + concat_impl_size_separator<CharT, std::pair<P1, P2>>(separator)
+                 + concat_impl_size_element<CharT>(separator, pair.second);
+        }
+
+        template <typename CharT, typename S, typename T, typename... Args>
+        std::size_t concat_impl_size_element(const S& separator, const T& head, const Args&... tail) {
+            return concat_impl_size_element<CharT>(separator, head)
+                 + concat_impl_size_separator<CharT, T>(separator)
+                 + concat_impl_size_element<CharT>(separator, tail...);
+        }
+    }
+
+    namespace { // concat_impl : stringstream to string helper, separator handlers, and parameter writer functions
+
+        template <typename CharT, typename W>
+        std::basic_string<CharT> concat_to_string(const W& writer) {
+            return writer.good() ? writer.str() : std::basic_string<CharT>();
+        }
+
+        template <typename W, typename S>
+        void separate(W& writer, const S* separator) {
+            if (separator) writer << separator;
+        }
+
+        template <typename W, typename S>
+        void separate(W& writer, const S& separator) {
+            writer << separator;
+        }
+
+        template <typename W, char head, char... tail>
+        void separate(W& writer, const char_separator<head, tail...>&) {
+            writer << char_separator<head, tail...>::value;
+        }
+
+        template <typename W, char head>
+        void separate(W& writer, const char_separator<head>&) {
+            writer << head;
+        }
+
+        template <typename CharT, typename B, typename S>
+        void separate(string_writer<CharT, B>& writer, const S* separator) {
+            if (separator) writer.write_separator(separator, std::char_traits<S>::length(separator));
+        }
+
+        template <typename CharT, typename B, char head, char... tail>
+        void separate(string_writer<CharT, B>& writer, const char_separator<head, tail...>&) {
+            writer.write_separator(char_separator<head, tail...>::value, char_separator<head, tail...>::size);
+        }
+
+        template <typename CharT, typename B, char head>
+        void separate(string_writer<CharT, B>& writer, const char_separator<head>&) {
+            writer.write_separator(head);
+        }
+
+        template <typename CharT, typename T, typename W, typename S>
+        void concat_impl_write_separator(W& writer, const S& separator) {
+            if (!is_manipulator<CharT, T>::value) separate(writer, separator);
+        }
+
+        template <typename CharT, typename W, typename S, typename... Args>
+        void concat_impl_write_element(W&, const S&, const std::tuple<Args...>&);
+
+        template <typename CharT, typename W, typename S, typename P1, typename P2>
+        void concat_impl_write_element(W&, const S&, const std::pair<P1, P2>&);
+
+        // host streams keep the roundtrip and escape modes in iword slots
+        template <typename CharT, typename W, typename T, write_as K>
+        void concat_impl_write_host(W& writer, const T& element, write_tag<K>) {
+            writer << element;
+        }
+
+        template <typename CharT, typename W, typename T>
+        void concat_impl_write_host(W& writer, const T& element, write_tag<write_as::floating>) {
+            if (writer.iword(roundtrip_t::index()) && std::isfinite(element)) {
+                char buffer[48];
+                writer << std::basic_string<CharT>(buffer, buffer + format_shortest(buffer, element));
+            } else {
+                writer << element;
+            }
+        }
+
+        template <typename CharT, typename W>
+        void concat_impl_write_host_text(W& writer, const CharT* s, std::size_t n) {
+            const escape_t escaping = escape_t::from_word(writer.iword(escape_t::index()));
+            if (escaping.mode == escape_mode::none && writer.width() == 0) return void(writer.write(s, n));
+            std::basic_string<CharT> text;
+            if (escaping.mode == escape_mode::none) text.assign(s, n);
+            else escape_text(escaping, s, n, [&text](const CharT* span, std::size_t length) { text.append(span, length); });
+            writer << text;
+        }
+
+        template <typename CharT, typename W, typename T>
+        void concat_impl_write_host(W& writer, const T& c, write_tag<write_as::character>) {
+            const CharT text = CharT(c);
+            if (writer.iword(escape_t::index())) concat_impl_write_host_text(writer, &text, 1);
+            else writer << c;
+        }
+
+        template <typename CharT, typename W, typename T>
+        void concat_impl_write_host(W& writer, const T& s, write_tag<write_as::c_str>) {
+            if (writer.iword(escape_t::index())) concat_impl_write_host_text(writer, s, std::char_traits<CharT>::length(s));
+            else writer << s;
+        }
+
+        template <typename CharT, typename W, typename T>
+        void concat_impl_write_host(W& writer, const T& s, write_tag<write_as::string>) {
+            if (writer.iword(escape_t::index())) concat_impl_write_host_text(writer, s.data(), s.size());
+            else writer << s;
+        }
+
+        // host streams can't take text of another char type, it is transcoded first
+        template <typename CharT, typename W, typename T>
+        void concat_impl_write_host(W& writer, const T& s, write_tag<write_as::foreign>) {
+            const std::basic_string<CharT> text = transcoded<CharT>(s);
+            concat_impl_write_host_text(writer, text.data(), text.size());
+        }
+
+        // we have 6 base cases, depending of the parameter type:
+        template <typename CharT, typename W, typename T>
+            enable_if_t<!std::is_base_of<std::ios_base, W>::value,
+        void> concat_impl_write_value(W& writer, const T& element) {
+            writer << element;
+        }
+
+        template <typename CharT, typename W, typename T>
+            enable_if_t<std::is_base_of<std::ios_base, W>::value,
+        void> concat_impl_write_value(W& writer, const T& element) {
+            concat_impl_write_host<CharT>(writer, element, write_category<CharT, T>());
+        }
+
+        // 1. base case any type compatible with << that doesn't require a special handling
+        template <typename CharT, typename W, typename S, typename T>
+            enable_if_t<!is_iterable<T>::value && !is_stringstream<T>::value,
+        void> concat_impl_write_element(W& writer, const S&, const T& element) {
+            concat_impl_write_value<CharT>(writer, element);
+        }
+
+        // 2. base case for fundamental built-in string types (const CharT* family, a.k.a. cstrings)
+        template <typename CharT, typename W, typename S, typename T>
+            enable_if_t<is_char_sequence<T*>::value,
+        void> concat_impl_write_element(W& writer, const S&, const T* element) {
+            if (element) concat_impl_write_value<CharT>(writer, element);
+        }
+
+        template <typename CharT, typename B>
+        void concat_impl_write_stringbuf(string_writer<CharT, B>& writer, const std::basic_stringbuf<CharT>* guest) {
+            const stringbuf_text<CharT> text(guest);
+            if (text.in_place) writer.write_lasting(text.first, text.size());
+            else writer.write_chars(text.first, text.size());
+        }
+
+        // a host stream can also be its own guest, then the text is copied first because writing may reallocate it
+        template <typename CharT, typename W>
+        void concat_impl_write_stringbuf(W& writer, const std::basic_stringbuf<CharT>* guest) {
+            const stringbuf_text<CharT> text(guest);
+            if (text.in_place && writer.rdbuf() == guest) {
+                const std::basic_string<CharT> copy(text.first, text.second);
+                concat_impl_write_host_text(writer, copy.data(), copy.size());
+            } else {
+                concat_impl_write_host_text(writer, text.first, text.second - text.first);
+            }
+        }
+
+        // 3. base case for std::stringstream types, their buffer is read in place
+        template <typename CharT, typename W, typename S, typename T>
+            enable_if_t<is_stringstream<T>::value,
+        void> concat_impl_write_element(W& writer, const S&, const T& element) {
+            if (element.good()) concat_impl_write_stringbuf(writer, element.rdbuf());
+            else writer.setstate(element.rdstate());
+        }
+
+        template <typename CharT, typename W, typename S, typename T>
+        void concat_impl_join(W& writer, const S& separator, const T& container) {
+            auto it = std::begin(container), et = std::end(container);
+            while(it != et) {
+                concat_impl_write_element<CharT>(writer, separator, *it);
+                if (++it != et) concat_impl_write_separator<CharT, T>(writer, separator);
+            }
+        }
+
+        // ranges of strings and integers skip the per element dispatch, concat_impl_append has already reserved their size
+        template <typename CharT, typename B, typename T>
+            enable_if_t<is_flat_range<CharT, T>::value,
+        void> concat_impl_join(string_writer<CharT, B>& writer, const CharT* separator, const T& container) {
+            if (writer.plain()) writer.write_join(container, separator, separator_size(separator));
+            else concat_impl_join<CharT, string_writer<CharT, B>, const CharT*, T>(writer, separator, container);
+        }
+
+        template <typename CharT, typename B, typename T, char head, char... tail>
+            enable_if_t<std::is_same<CharT, char>::value && is_flat_range<CharT, T>::value,
+        void> concat_impl_join(string_writer<CharT, B>& writer, const char_separator<head, tail...>& separator, const T& container) {
+            typedef char_separator<head, tail...> S;
+            if (writer.plain()) writer.write_join(container, S::value, S::size);
+            else concat_impl_join<CharT, string_writer<CharT, B>, S, T>(writer, separator, container);
+        }
+
+        template <typename It>
+        struct iterator_range {
+            It first, last;
+            It begin() const { return first; }
+            It end()   const { return last;  }
+        };
+
+        // below this many elements per chunk, starting a thread costs more than formatting the chunk
+        constexpr std::size_t parallel_min_chunk = 8192;
+
+        // each chunk is formatted into its own string with a copy of the writer format, and the chunks are copied
+        // in order. The serial join is used when a chunk ends with a different format, as the next chunk would
+        // have started with it
+        template <typename CharT, typename B, typename S, typename T>
+        void concat_impl_join(string_writer<CharT, B>& writer, const S& separator, const parallel_range<T>& range) {
+            typedef typename parallel_range<T>::range_type range_type;
+            typedef decltype(std::begin(range.base())) iterator;
+            const std::size_t size   = std::distance(std::begin(range.base()), std::end(range.base()));
+            const std::size_t chunks = size < 2 * parallel_min_chunk ? 1 // hardware_concurrency() can be a system call
+                                     : std::min<std::size_t>(range.thread_count(), size / parallel_min_chunk);
+            auto serial = [&] { // measured here, as concat_impl_append skipped the range
+                writer.reserve(concat_impl_size_element<CharT>(separator, range.base()));
+                concat_impl_join<CharT>(writer, separator, range.base());
+            };
+            if (chunks < 2 || !writer.plain()) return serial();
+
+            std::vector<std::basic_string<CharT>> texts(chunks);
+            auto format_chunk = [&writer, &separator, &texts](std::size_t i, iterator first, iterator last) {
+                string_writer<CharT> chunk(texts[i]);
+                if (!chunk.copy_format(writer)) return false;
+                concat_impl_join<CharT>(chunk, separator, iterator_range<iterator>{first, last});
+                return chunk.plain() && chunk.same_format(writer);
+            };
+
+            std::vector<std::future<bool>> tasks;
+            iterator first = std::begin(range.base());
+            for (std::size_t i = 0; i + 1 < chunks; i++) {
+                iterator last = first;
+                std::advance(last, size * (i + 1) / chunks - size * i / chunks);
+                tasks.push_back(std::async(std::launch::async, format_chunk, i, first, last));
+                first = last;
+            }
+            bool same = format_chunk(chunks - 1, first, std::end(range.base()));
+            for (auto& task : tasks) same = task.get() && same;
+            if (!same) return serial();
+
+            std::size_t total = (chunks - 1) * concat_impl_size_separator<CharT, range_type>(separator);
+            for (const auto& text : texts) total += text.size();
+            writer.reserve(total);
+            for (std::size_t i = 0; i < chunks; i++) {
+                if (i) concat_impl_write_separator<CharT, range_type>(writer, separator);
+                writer.write_chars(texts[i].data(), texts[i].size());
+            }
+        }
+
+        // 4. base case for containers, arrays, and any iterable type EXCEPT the standard string types
+        template <typename CharT, typename W, typename S, typename T>
+            enable_if_t<is_iterable<T>::value,
+        void> concat_impl_write_element(W& writer, const S& separator, const T& container) {
+            concat_impl_join<CharT>(writer, separator, container);
+        }
+
+        // 5. base case for std::tuples
+        template<unsigned N, unsigned Last>
+        struct tuple_printer {
+            template<typename CharT, typename W, typename S, typename T>
+            static void print(W& writer, const S& separator, const T& tuple) {
+                concat_impl_write_element<CharT>(writer, separator, std::get<N>(tuple));
+                concat_impl_write_separator<CharT, T>(writer, separator);
+                tuple_printer<N + 1, Last>::template print<CharT>(writer, separator, tuple);
+            }
+        };
+
+        template<unsigned N>
+        struct tuple_printer<N, N> {
+            template<typename CharT, typename W, typename S, typename T>
+            static void print(W& writer, const S& separator, const T& tuple) {
+                concat_impl_write_element<CharT>(writer, separator, std::get<N>(tuple));
+            }
+        };
+
+        template <typename CharT, typename W, typename S, typename... Args>
+        inline void concat_impl_write_element(W& writer, const S& separator, const std::tuple<Args...>& tuple) {
+            tuple_printer<0, sizeof...(Args) - 1>::template print<CharT>(writer, separator, tuple);
+        }
+
+        // 6. base case for std::pairs
+        template <typename CharT, typename W, typename S, typename P1, typename P2>
+        inline void concat_impl_write_element(W& writer, const S& separator, const std::pair<P1, P2>& pair) {
+            concat_impl_write_element<CharT>(writer, separator, pair.first);
+            concat_impl_write_separator<CharT, std::pair<P1, P2>>(writer, separator);
+            concat_impl_write_element<CharT>(writer, separator, pair.second);
+        }
+
+        // the following function is the recursive step that unpacks all the variadic parameters
+        template <typename CharT, typename W, typename S, typename T, typename... Args>
+        void concat_impl_write_element(W& writer, const S& separator, const T& head, const Args&... tail) {
+            concat_impl_write_element<CharT>(writer, separator, head);
+            concat_impl_write_separator<CharT, T>(writer, separator);
+            concat_impl_write_element<CharT>(writer, separator, tail...);
+        }
+
+        // rearranges the parameters in order to prepare the recursive calls
+        template <typename CharT, typename S, typename T, typename... Args,
+            typename = enable_if_t<is_writable_stream<T, CharT>::value, T>>
+        std::basic_string<CharT> concat_impl(const S& separator, T& writer, const Args&... seq) {
+            concat_impl_write_element<CharT>(writer, separator, seq...);
+            return concat_to_string<CharT>(writer);
+        }
+
+        // buffers that can't reserve (like fixed_string) are not measured at all
+        template <typename CharT, typename B, typename S, typename... Args>
+            enable_if_t<can_reserve<B>::value,
+        void> concat_impl_reserve(B& out, const S& separator, const Args&... seq) {
+            reserve_more(out, concat_impl_size_element<CharT>(separator, seq...));
+        }
+
+        template <typename CharT, typename B, typename S, typename... Args>
+            enable_if_t<!can_reserve<B>::value,
+        void> concat_impl_reserve(B&, const S&, const Args&...) {}
+
+        // appends the parameters to a string or container, which is left untouched when a parameter fails
+        template <typename CharT, typename B, typename S, typename... Args>
+        bool concat_impl_append(B& out, const S& separator, const Args&... seq) {
+            const auto size      = out.size();
+            const bool truncated = buffer_truncated(out);
+            concat_impl_reserve<CharT>(out, separator, seq...);
+            string_writer<CharT, B> writer(out);
+            concat_impl_write_element<CharT>(writer, separator, seq...);
+            if (!writer.good()) buffer_rollback(out, size, truncated);
+            return writer.good();
+        }
+
+#ifdef THEYPSILON_CONCAT_POSIX
+        // a file descriptor gets every segment in a single writev (or write, for a single segment), repeated only
+        // for partial writes. Segments is a gather_buffer, or anything with for_each and max_segments
+        template <typename Segments>
+        bool concat_impl_flush(int fd, const Segments& buffer) {
+            iovec segments[Segments::max_segments];
+            int count = 0;
+            buffer.for_each([&](const char* s, std::size_t n) {
+                segments[count].iov_base = const_cast<char*>(s);
+                segments[count++].iov_len = n;
+            });
+
+            iovec* next = segments;
+            while (count > 0) {
+                const ssize_t written = count == 1 ? ::write(fd, next->iov_base, next->iov_len) : ::writev(fd, next, count);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                std::size_t rest = std::size_t(written);
+                for (; count > 0 && rest >= next->iov_len; next++, count--) rest -= next->iov_len;
+                if (count > 0) {
+                    next->iov_base = static_cast<char*>(next->iov_base) + rest;
+                    next->iov_len -= rest;
+                }
+            }
+            return true;
+        }
+#endif
+
+        // the lock keeps the text in one piece when other threads write to the same FILE
+        template <typename Segments>
+        bool concat_impl_flush(std::FILE* file, const Segments& buffer) {
+            bool written = true;
+#ifdef THEYPSILON_CONCAT_POSIX
+            flockfile(file);
+#endif
+            buffer.for_each([&](const char* s, std::size_t n) {
+                written = written && std::fwrite(s, 1, n, file) == n;
+            });
+#ifdef THEYPSILON_CONCAT_POSIX
+            funlockfile(file);
+#endif
+            return written;
+        }
+
+        // nothing is written when a parameter fails
+        template <typename Sink, typename S, typename... Args>
+        bool concat_impl_write(Sink sink, const S& separator, const Args&... seq) {
+            gather_buffer<char> buffer;
+            return concat_impl_append<char>(buffer, separator, seq...) && concat_impl_flush(sink, buffer);
+        }
+
+        // when the first parameter is not a stringstream non-const reference, the result is written directly
+        template <typename CharT, typename S, typename... Args>
+        std::basic_string<CharT> concat_impl(const S& separator, const Args&... seq) {
+            std::basic_string<CharT> result;
+            concat_impl_append<CharT>(result, separator, seq...);
+            return result;
+        }
+    }
+
+    // the 5 entry points:
+    // 1. entry point,  when received a separator as first element
+    template <typename CharT = char, typename... Args>
+    std::basic_string<CharT> concat(const separator_t<CharT>& sep, Args&&... seq) {
+        return concat_impl<CharT>(
+            sep.sep,
+            std::forward<Args>(seq)...
+        );
+    }
+
+    // 2. entry point,  when the separator es specified via templated char-pack arguments
+    template <char head, char... tail, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    std::basic_string<char> concat(F&& first, Args&&... rest) {
+        return concat_impl<char>(
+            char_separator<head, tail...>(),
+            std::forward<F>(first),
+            std::forward<Args>(rest)...
+        );
+    }
+
+    // 3. entry point, when the separator is a template argument of compile-time defined const char*
+    template <const char* sep, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    std::basic_string<char> concat(F&& first, Args&&... rest) {
+        return concat_impl<char>(
+            sep,
+            std::forward<F>(first),
+            std::forward<Args>(rest)...
+        );
+    }
 
     // 4. entry point,  when there is no separator.
     template <typename CharT = char, typename F, typename... Args,
         typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
-    std::basic_string<CharT> concat(F&& first, Args&&... rest) {
-        return concat_impl<CharT>(
-            (const CharT*)nullptr,
-            std::forward<F>(first),
-            std::forward<Args>(rest)...
-        );
+    std::basic_string<CharT> concat(F&& first, Args&&... rest) {
+        return concat_impl<CharT>(
+            (const CharT*)nullptr,
+            std::forward<F>(first),
+            std::forward<Args>(rest)...
+        );
+    }
+
+    // 5. entry point,  when the separator is std::endl passed as template argument
+    template <std::ostream& sep (std::ostream&), typename CharT = char, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
+    std::basic_string<CharT> concat(F&& first, Args&&... rest) {
+        return concat_impl<CharT>(
+            sep,
+            std::forward<F>(first),
+            std::forward<Args>(rest)...
+        );
+    }
+
+    namespace { // default format state : what a deferred text resets in the stream it is written to
+
+        // puts the stream in the format state of a new one (flags, precision, fill, and no roundtrip or escape mode)
+        // and gives the previous state back when destroyed, also when a parameter throws
+        template <typename CharT>
+        class default_format {
+            std::basic_ostream<CharT>&    out;
+            const std::ios_base::fmtflags flags;
+            const std::streamsize         precision;
+            const CharT                   fill;
+            const long                    roundtrip;
+            const long                    escaping;
+
+            static long reset_word(std::ios_base& out, int index) {
+                const long word = out.iword(index);
+                out.iword(index) = 0;
+                return word;
+            }
+
+        public:
+            explicit default_format(std::basic_ostream<CharT>& out)
+                : out(out), flags(out.flags(std::ios_base::skipws | std::ios_base::dec)), precision(out.precision(6)),
+                  fill(out.fill(out.widen(' '))), roundtrip(reset_word(out, roundtrip_t::index())),
+                  escaping(reset_word(out, escape_t::index())) {}
+
+            default_format(const default_format&) = delete;
+            default_format& operator=(const default_format&) = delete;
+
+            ~default_format() {
+                out.flags(flags);
+                out.precision(precision);
+                out.fill(fill);
+                out.width(0);
+                out.iword(roundtrip_t::index()) = roundtrip;
+                out.iword(escape_t::index())    = escaping;
+            }
+        };
+    }
+
+    template <typename CharT, typename S, typename... Args>
+    class concat_expression { // result of concat_lazy, holds the parameters (Args are references for lvalues) and
+                              // formats nothing up front
+        S                   sep;
+        std::tuple<Args...> args;
+
+        template <typename W, std::size_t... I>
+        void write(W& writer, index_sequence<I...>) const {
+            concat_impl_write_element<CharT>(writer, sep, std::get<I>(args)...);
+        }
+
+        template <typename B, std::size_t... I>
+        bool append(B& out, index_sequence<I...>) const {
+            return concat_impl_append<CharT>(out, sep, std::get<I>(args)...);
+        }
+
+    public:
+        template <typename... A>
+        concat_expression(const S& sep, A&&... args) : sep(sep), args(std::forward<A>(args)...) {}
+
+        // formats the parameters without storing them
+        std::size_t size() const {
+            counting_buffer<CharT> counter;
+            append(counter, make_index_sequence<sizeof...(Args)>());
+            return counter.size();
+        }
+
+        std::basic_string<CharT> str() const {
+            std::basic_string<CharT> result;
+            append(result, make_index_sequence<sizeof...(Args)>());
+            return result;
+        }
+
+        operator std::basic_string<CharT>() const { return str(); }
+
+        // same as concat_into
+        template <typename B>
+        B& append_to(B& out) const {
+            append(out, make_index_sequence<sizeof...(Args)>());
+            return out;
+        }
+
+        // writes the parameters straight into the stream, as if it was the host stream of concat. They are written
+        // in the default format state, so the text is the one of str(), and the format state of the stream is
+        // restored afterwards. A pending setw applies to the whole text like it does for strings
+        std::basic_ostream<CharT>& write_to(std::basic_ostream<CharT>& out) const {
+            if (out.width() != 0) return out << str();
+            const default_format<CharT> state(out);
+            write(out, make_index_sequence<sizeof...(Args)>());
+            return out;
+        }
+
+        friend std::basic_ostream<CharT>& operator<<(std::basic_ostream<CharT>& out, const concat_expression& e) {
+            return e.write_to(out);
+        }
+    };
+
+    // the concat_lazy variants only capture references to lvalue parameters, which must outlive the expression,
+    // temporaries are moved into it. Nothing is formatted until the expression is streamed or converted, so it
+    // costs nothing when discarded
+    template <typename CharT = char, typename... Args>
+    concat_expression<CharT, const CharT*, Args...> concat_lazy(const separator_t<CharT>& sep, Args&&... seq) {
+        return concat_expression<CharT, const CharT*, Args...>(sep.sep, std::forward<Args>(seq)...);
+    }
+
+    template <char head, char... tail, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<typename std::decay<F>::type, separator_t<char>>::value, F>>
+    concat_expression<char, char_separator<head, tail...>, F, Args...> concat_lazy(F&& first, Args&&... rest) {
+        return concat_expression<char, char_separator<head, tail...>, F, Args...>(char_separator<head, tail...>(),
+                                                                                  std::forward<F>(first),
+                                                                                  std::forward<Args>(rest)...);
+    }
+
+    template <const char* sep, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<typename std::decay<F>::type, separator_t<char>>::value, F>>
+    concat_expression<char, const char*, F, Args...> concat_lazy(F&& first, Args&&... rest) {
+        return concat_expression<char, const char*, F, Args...>(sep, std::forward<F>(first), std::forward<Args>(rest)...);
+    }
+
+    template <typename CharT = char, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<typename std::decay<F>::type, separator_t<CharT>>::value, F>>
+    concat_expression<CharT, const CharT*, F, Args...> concat_lazy(F&& first, Args&&... rest) {
+        return concat_expression<CharT, const CharT*, F, Args...>(nullptr, std::forward<F>(first), std::forward<Args>(rest)...);
+    }
+
+    template <std::ostream& sep (std::ostream&), typename CharT = char, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<typename std::decay<F>::type, separator_t<CharT>>::value, F>>
+    concat_expression<CharT, std::ostream& (*)(std::ostream&), F, Args...> concat_lazy(F&& first, Args&&... rest) {
+        return concat_expression<CharT, std::ostream& (*)(std::ostream&), F, Args...>(sep, std::forward<F>(first),
+                                                                                       std::forward<Args>(rest)...);
+    }
+
+    namespace { // snapshot : the copy concat_deferred keeps of a parameter, which doesn't refer to anything else
+
+        template <typename CharT, typename T, typename = void>
+        struct snapshot { // numbers, strings, user defined types and manipulators are copied as they are
+            typedef T type;
+            static const T& take(const T& value, bool&) { return value; }
+        };
+
+        template <typename CharT, typename T>
+        using snapshot_of = snapshot<CharT, typename std::remove_cv<typename std::remove_reference<T>::type>::type>;
+
+        template <typename CharT, typename T>
+        struct snapshot<CharT, T, enable_if_t<std::is_function<T>::value>> { // functions live forever
+            typedef T& type;
+            static T& take(T& function, bool&) { return function; }
+        };
+
+        template <typename CharT, typename T>
+        struct snapshot<CharT, T*, enable_if_t<is_char_sequence<T*>::value>> {
+            typedef std::basic_string<typename std::remove_cv<T>::type> type;
+            static type take(const T* s, bool&) { return s ? type(s) : type(); }
+        };
+
+        template <typename CharT, typename T, std::size_t N>
+        struct snapshot<CharT, T[N], enable_if_t<is_char_sequence<T*>::value>> : snapshot<CharT, const T*> {};
+
+        template <typename CharT, typename T>
+        struct snapshot<CharT, T, enable_if_t<is_iterable<T>::value && !is_char_sequence<typename std::decay<T>::type>::value>> {
+            typedef typename std::iterator_traits<decltype(std::begin(std::declval<const T&>()))>::value_type element;
+            typedef std::vector<typename snapshot_of<CharT, element>::type> type;
+
+            static type take(const T& container, bool& failed) {
+                type copy;
+                for (const auto& e : container) copy.push_back(snapshot_of<CharT, element>::take(e, failed));
+                return copy;
+            }
+        };
+
+        template <typename CharT, typename T>
+        struct snapshot<CharT, T, enable_if_t<is_stringstream<T, CharT>::value>> {
+            typedef std::basic_string<CharT> type;
+
+            static type take(const T& stream, bool& failed) {
+                if (!stream.good()) failed = true;
+                const stringbuf_text<CharT> text(stream.rdbuf());
+                return type(text.first, text.second);
+            }
+        };
+
+        template <typename CharT, typename A, typename B>
+        struct snapshot<CharT, std::pair<A, B>> {
+            typedef std::pair<typename snapshot_of<CharT, A>::type, typename snapshot_of<CharT, B>::type> type;
+
+            static type take(const std::pair<A, B>& pair, bool& failed) {
+                return type(snapshot_of<CharT, A>::take(pair.first, failed), snapshot_of<CharT, B>::take(pair.second, failed));
+            }
+        };
+
+        template <typename CharT, typename... Args>
+        struct snapshot<CharT, std::tuple<Args...>> {
+            typedef std::tuple<typename snapshot_of<CharT, Args>::type...> type;
+
+            template <std::size_t... I>
+            static type take(const std::tuple<Args...>& tuple, bool& failed, index_sequence<I...>) {
+                return type(snapshot_of<CharT, Args>::take(std::get<I>(tuple), failed)...);
+            }
+
+            static type take(const std::tuple<Args...>& tuple, bool& failed) {
+                return take(tuple, failed, make_index_sequence<sizeof...(Args)>());
+            }
+        };
+    }
+
+    template <typename CharT = char>
+    class concat_record { // result of concat_deferred, owns copies of the parameters and formats them on demand. The
+                          // parameter types are erased, so records of different calls can share a queue
+        struct formatter {
+            virtual ~formatter() {}
+            virtual void append(std::basic_string<CharT>& out) const = 0;
+            virtual void write(std::basic_ostream<CharT>& out) const = 0;
+            virtual formatter* move_to(void* storage) = 0; // only called on records kept inline
+        };
+
+        template <typename S, typename... Args>
+        class holder : public formatter {
+            std::basic_string<CharT> separator_text; // cstring separators may point to the caller's memory
+            S                        separator;
+            bool                     failed = false; // a stringstream parameter had failed
+            std::tuple<Args...>      args;
+
+            static void keep(const CharT*& s, std::basic_string<CharT>& copy) {
+                if (s) s = (copy = s).c_str();
+            }
+
+            template <typename T>
+            static void keep(T&, std::basic_string<CharT>&) {}
+
+            static void point(const CharT*& s, const std::basic_string<CharT>& copy) {
+                if (s) s = copy.c_str();
+            }
+
+            template <typename T>
+            static void point(T&, const std::basic_string<CharT>&) {}
+
+            template <std::size_t... I>
+            concat_expression<CharT, S, const Args&...> expression(index_sequence<I...>) const {
+                return concat_expression<CharT, S, const Args&...>(separator, std::get<I>(args)...);
+            }
+
+        public:
+            template <typename... A>
+            holder(const S& sep, const A&... seq) : separator(sep), args(snapshot_of<CharT, A>::take(seq, failed)...) {
+                keep(separator, separator_text);
+            }
+
+            holder(holder&& other) noexcept(std::is_nothrow_move_constructible<std::tuple<Args...>>::value)
+                : separator_text(std::move(other.separator_text)), separator(other.separator), failed(other.failed),
+                  args(std::move(other.args)) {
+                point(separator, separator_text);
+            }
+
+            void append(std::basic_string<CharT>& out) const override {
+                if (!failed) expression(make_index_sequence<sizeof...(Args)>()).append_to(out);
+            }
+
+            // a failed record writes nothing, and leaves the stream good for the records after it
+            void write(std::basic_ostream<CharT>& out) const override {
+                if (!failed) expression(make_index_sequence<sizeof...(Args)>()).write_to(out);
+            }
+
+            formatter* move_to(void* storage) override { return new (storage) holder(std::move(*this)); }
+        };
+
+    public:
+        // records whose copies fit here are kept inside the record, so capturing them allocates nothing more than
+        // the copies themselves (long strings and containers). Bigger records are allocated
+        static constexpr std::size_t inline_size = 192;
+
+    private:
+        typename std::aligned_storage<inline_size>::type storage;
+        formatter*                                      captured = nullptr;
+
+        bool is_inline() const { return static_cast<const void*>(captured) == static_cast<const void*>(&storage); }
+
+        void reset() {
+            if (is_inline()) captured->~formatter();
+            else delete captured;
+            captured = nullptr;
+        }
+
+        template <typename H>
+        using fits_inline = std::integral_constant<bool, sizeof(H) <= inline_size &&
+            alignof(typename std::aligned_storage<inline_size>::type) % alignof(H) == 0 &&
+            std::is_nothrow_move_constructible<H>::value>;
+
+        template <typename H, typename S, typename... Args>
+        enable_if_t<fits_inline<H>::value,
+        void> emplace(const S& separator, const Args&... seq) {
+            captured = new (&storage) H(separator, seq...);
+        }
+
+        template <typename H, typename S, typename... Args>
+        enable_if_t<!fits_inline<H>::value,
+        void> emplace(const S& separator, const Args&... seq) {
+            captured = new H(separator, seq...);
+        }
+
+    public:
+        concat_record() = default;
+
+        concat_record(concat_record&& other) noexcept {
+            *this = std::move(other);
+        }
+
+        concat_record& operator=(concat_record&& other) noexcept {
+            if (this == &other) return *this;
+            reset();
+            if (other.is_inline()) {
+                captured = other.captured->move_to(&storage);
+                other.reset();
+            } else {
+                captured = other.captured;
+                other.captured = nullptr;
+            }
+            return *this;
+        }
+
+        ~concat_record() { reset(); }
+
+        template <typename S, typename... Args>
+        static concat_record capture(const S& separator, const Args&... seq) {
+            concat_record record;
+            record.template emplace<holder<S, typename snapshot_of<CharT, Args>::type...>>(separator, seq...);
+            return record;
+        }
+
+        std::basic_string<CharT> str() const {
+            std::basic_string<CharT> result;
+            if (captured) captured->append(result);
+            return result;
+        }
+
+        operator std::basic_string<CharT>() const { return str(); }
+
+        std::basic_string<CharT>& append_to(std::basic_string<CharT>& out) const {
+            if (captured) captured->append(out);
+            return out;
+        }
+
+        friend std::basic_ostream<CharT>& operator<<(std::basic_ostream<CharT>& out, const concat_record& record) {
+            if (record.captured) record.captured->write(out);
+            return out;
+        }
+    };
+
+    template <typename CharT> constexpr std::size_t concat_record<CharT>::inline_size;
+
+    // the concat_deferred variants copy the parameters into a record right away (cstrings as strings, containers
+    // and stringstreams as snapshots of their contents) and format nothing, so the record can be formatted
+    // later on another thread while the parameters change or go away
+    template <typename CharT = char, typename... Args>
+    concat_record<CharT> concat_deferred(const separator_t<CharT>& sep, const Args&... seq) {
+        return concat_record<CharT>::capture(sep.sep, seq...);
+    }
+
+    template <char head, char... tail, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    concat_record<char> concat_deferred(const F& first, const Args&... rest) {
+        return concat_record<char>::capture(char_separator<head, tail...>(), first, rest...);
+    }
+
+    template <typename CharT = char, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
+    concat_record<CharT> concat_deferred(const F& first, const Args&... rest) {
+        return concat_record<CharT>::capture((const CharT*)nullptr, first, rest...);
+    }
+
+    // the concat_into variants append to an existing string (or any container with append or push_back)
+    // instead of returning a new one, so a long-lived buffer can be cleared and refilled without allocating
+    template <typename B, typename CharT = typename B::value_type, typename... Args>
+    B& concat_into(B& out, const separator_t<CharT>& sep, Args&&... seq) {
+        concat_impl_append<CharT>(out, sep.sep, std::forward<Args>(seq)...);
+        return out;
+    }
+
+    template <char head, char... tail, typename B, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    B& concat_into(B& out, F&& first, Args&&... rest) {
+        concat_impl_append<char>(out, char_separator<head, tail...>(),
+                                 std::forward<F>(first), std::forward<Args>(rest)...);
+        return out;
+    }
+
+    template <const char* sep, typename B, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    B& concat_into(B& out, F&& first, Args&&... rest) {
+        concat_impl_append<char>(out, sep, std::forward<F>(first), std::forward<Args>(rest)...);
+        return out;
+    }
+
+    template <typename B, typename F, typename... Args, typename CharT = typename B::value_type,
+        typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
+    B& concat_into(B& out, F&& first, Args&&... rest) {
+        concat_impl_append<CharT>(out, (const CharT*)nullptr, std::forward<F>(first), std::forward<Args>(rest)...);
+        return out;
+    }
+
+    // the concat_n variants write into a fixed_string<N> stored inline, so they never touch the heap
+    // (unless a user defined type has to be written through a stream). Check truncated() for overflows
+    template <std::size_t N, typename CharT = char, typename... Args>
+    fixed_string<N, CharT> concat_n(const separator_t<CharT>& sep, Args&&... seq) {
+        fixed_string<N, CharT> result;
+        concat_impl_append<CharT>(result, sep.sep, std::forward<Args>(seq)...);
+        return result;
+    }
+
+    template <std::size_t N, char head, char... tail, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    fixed_string<N> concat_n(F&& first, Args&&... rest) {
+        fixed_string<N> result;
+        concat_impl_append<char>(result, char_separator<head, tail...>(),
+                                 std::forward<F>(first), std::forward<Args>(rest)...);
+        return result;
+    }
+
+    template <std::size_t N, typename CharT = char, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
+    fixed_string<N, CharT> concat_n(F&& first, Args&&... rest) {
+        fixed_string<N, CharT> result;
+        concat_impl_append<CharT>(result, (const CharT*)nullptr, std::forward<F>(first), std::forward<Args>(rest)...);
+        return result;
+    }
+
+    namespace { // compile-time text : the literal parameters of concat_c turned into constant_string
+
+        constexpr std::size_t constant_strlen(const char* s) { return *s ? 1 + constant_strlen(s + 1) : 0; }
+
+        template <typename T>
+        constexpr bool constant_negative(T v) { return v < T(); }
+
+        template <typename T>
+        constexpr T constant_abs(T v) { return v < T() ? -v : v; }
+
+        template <typename T>
+        constexpr std::size_t constant_digits(T v) { return v / 10 ? 1 + constant_digits(T(v / 10)) : 1; }
+
+        template <typename T>
+        constexpr std::size_t constant_length(T v) { return constant_digits(v) + constant_negative(v); }
+
+        template <typename T>
+        constexpr T constant_power(std::size_t n) { return n ? T(10 * constant_power<T>(n - 1)) : T(1); }
+
+        // the i-th character of the base 10 text of v. v is never negated, so the lowest value is fine too
+        template <typename T>
+        constexpr char constant_digit(T v, std::size_t i) {
+            return constant_negative(v) && i == 0 ? '-' :
+                   char('0' + constant_abs((v / constant_power<T>(constant_length(v) - 1 - i)) % 10));
+        }
+
+        template <typename CharT, std::size_t... I>
+        constexpr constant_string<sizeof...(I), CharT> constant_chars(const CharT* s, index_sequence<I...>) {
+            return constant_string<sizeof...(I), CharT>(s[I]...);
+        }
+
+        template <typename T, std::size_t... I>
+        constexpr constant_string<sizeof...(I)> constant_integer(T v, index_sequence<I...>) {
+            return constant_string<sizeof...(I)>(constant_digit(v, I)...);
+        }
+
+        template <std::size_t L, std::size_t R, typename CharT, std::size_t... I>
+        constexpr constant_string<L + R, CharT> constant_join(const constant_string<L, CharT>& a,
+                                                              const constant_string<R, CharT>& b, index_sequence<I...>) {
+            return constant_string<L + R, CharT>((I < L ? a[I] : b[I - L])...);
+        }
+
+        template <std::size_t L, std::size_t R, typename CharT>
+        constexpr constant_string<L + R, CharT> constant_join(const constant_string<L, CharT>& a,
+                                                              const constant_string<R, CharT>& b) {
+            return constant_join(a, b, make_index_sequence<L + R>());
+        }
+
+        // string literals, without the ending '\0'. The length is part of the type, so an array whose text ends
+        // before its last char (what strlen would give at runtime) is refused: a compile error in constant
+        // expressions, an exception otherwise
+        template <std::size_t N>
+        constexpr constant_string<N - 1> constant_text(const char (&s)[N]) {
+            return constant_strlen(s) == N - 1 ? constant_chars(s, make_index_sequence<N - 1>()) :
+                   throw std::invalid_argument("concat_c: a char array must hold a string literal");
+        }
+
+        template <typename T>
+        constexpr enable_if_t<is_char_of<char, T>::value,
+        constant_string<1>> constant_text(T c) {
+            return constant_string<1>(char(c));
+        }
+
+        // integers are given as std::integral_constant, so their length is part of the type
+        template <typename T, T v>
+        constexpr enable_if_t<!is_char_of<char, T>::value,
+        constant_string<constant_length(v)>> constant_text(std::integral_constant<T, v>) {
+            return constant_integer(v, make_index_sequence<constant_length(v)>());
+        }
+
+        template <typename T, T v>
+        constexpr enable_if_t<is_char_of<char, T>::value,
+        constant_string<1>> constant_text(std::integral_constant<T, v>) {
+            return constant_string<1>(char(v));
+        }
+
+        template <std::size_t N>
+        constexpr constant_string<N> constant_text(const constant_string<N>& s) { return s; }
+
+        template <typename T>
+        using constant_text_of = decltype(constant_text(std::declval<const T&>()));
+
+        template <typename T>
+        struct constant_size;
+
+        template <std::size_t N, typename CharT>
+        struct constant_size<constant_string<N, CharT>> : std::integral_constant<std::size_t, N> {};
+
+        template <typename S, typename F, typename... Args>
+        struct constant_total : std::integral_constant<std::size_t, // length of the texts of F, Args... separated by S
+            constant_size<constant_text_of<F>>::value + constant_size<S>::value + constant_total<S, Args...>::value> {};
+
+        template <typename S, typename F>
+        struct constant_total<S, F> : constant_size<constant_text_of<F>> {};
+
+        template <typename S, typename F>
+        constexpr constant_text_of<F> constant_separated(const S&, const F& last) {
+            return constant_text(last);
+        }
+
+        template <typename S, typename F, typename... Args>
+        constexpr constant_string<constant_total<S, F, Args...>::value> constant_separated(const S& sep, const F& first,
+                                                                                           const Args&... rest) {
+            return constant_join(constant_join(constant_text(first), sep), constant_separated(sep, rest...));
+        }
+    }
+
+    // the concat_c variants only take string literals, chars and std::integral_constant integers, and build the text
+    // at compile time. Stored in a constexpr variable, the result costs nothing at runtime
+    template <typename F, typename... Args>
+    constexpr constant_string<constant_total<constant_string<0>, F, Args...>::value>
+    concat_c(const F& first, const Args&... rest) {
+        return constant_separated(constant_string<0>(), first, rest...);
+    }
+
+    template <char head, char... tail, typename F, typename... Args>
+    constexpr constant_string<constant_total<constant_string<sizeof...(tail) + 1>, F, Args...>::value>
+    concat_c(const F& first, const Args&... rest) {
+        return constant_separated(constant_chars(char_separator<head, tail...>::value,
+                                                 make_index_sequence<sizeof...(tail) + 1>()), first, rest...);
+    }
+
+    template <const char* sep, typename F, typename... Args>
+    constexpr constant_string<constant_total<constant_string<constant_strlen(sep)>, F, Args...>::value>
+    concat_c(const F& first, const Args&... rest) {
+        return constant_separated(constant_chars(sep, make_index_sequence<constant_strlen(sep)>()), first, rest...);
+    }
+
+    // the concat_write variants send the text to a file descriptor (with a single writev) or to a FILE. Long strings
+    // of the parameters are written from where they are, the rest is gathered in a scratch buffer on the stack.
+    // They return false when a parameter or the write failed (then errno tells why)
+    template <typename Sink, typename... Args, typename = enable_if_t<is_sink<Sink>::value, Sink>>
+    bool concat_write(Sink sink, const separator_t<char>& sep, Args&&... seq) {
+        return concat_impl_write(sink, sep.sep, std::forward<Args>(seq)...);
+    }
+
+    template <char head, char... tail, typename Sink, typename F, typename... Args,
+        typename = enable_if_t<is_sink<Sink>::value && !std::is_same<F, separator_t<char>>::value, F>>
+    bool concat_write(Sink sink, F&& first, Args&&... rest) {
+        return concat_impl_write(sink, char_separator<head, tail...>(), std::forward<F>(first), std::forward<Args>(rest)...);
+    }
+
+    template <const char* sep, typename Sink, typename F, typename... Args,
+        typename = enable_if_t<is_sink<Sink>::value && !std::is_same<F, separator_t<char>>::value, F>>
+    bool concat_write(Sink sink, F&& first, Args&&... rest) {
+        return concat_impl_write(sink, sep, std::forward<F>(first), std::forward<Args>(rest)...);
+    }
+
+    template <typename Sink, typename F, typename... Args,
+        typename = enable_if_t<is_sink<Sink>::value && !std::is_same<F, separator_t<char>>::value, F>>
+    bool concat_write(Sink sink, F&& first, Args&&... rest) {
+        return concat_impl_write(sink, (const char*)nullptr, std::forward<F>(first), std::forward<Args>(rest)...);
+    }
+
+    // a log sink for many threads: each message is formatted straight into a slot of a bounded lock-free ring
+    // (Dmitry Vyukov's bounded queue), and a background thread writes the ready slots to the file descriptor or
+    // FILE in batches. Messages longer than SlotSize - 1 are cut, and every message gets its own line
+    template <std::size_t SlotSize = 256>
+    class concat_log {
+        struct slot {
+            std::atomic<std::size_t> sequence; // == position when free, == position + 1 when its text is ready
+            fixed_string<SlotSize>   text;
+        };
+
+        struct batch { // the ready slots handed to concat_impl_flush at once
+            static constexpr std::size_t max_segments = 32;
+            const char* text  [max_segments];
+            std::size_t length[max_segments];
+            std::size_t count = 0;
+
+            template <typename F>
+            void for_each(F f) const {
+                for (std::size_t i = 0; i < count; i++) if (length[i]) f(text[i], length[i]);
+            }
+        };
+
+        std::unique_ptr<slot[]>   slots;
+        const std::size_t         mask;
+        std::atomic<std::size_t>  reserved_end   {0}; // next position reserved by a producer
+        std::atomic<std::size_t>  dropped_count  {0};
+        std::atomic<std::size_t>  truncated_count{0};
+        std::atomic<bool>         stopping       {false};
+        std::size_t               drained_end    = 0; // next position drained, only touched by the drainer
+        std::thread               drainer;
+
+        // a reserved slot is always handed to the drainer, which waits for it in order. When a parameter
+        // throws, it is handed empty
+        struct publisher {
+            slot&       reserved;
+            std::size_t position;
+            bool        complete;
+
+            ~publisher() {
+                if (!complete) reserved.text.resize(0);
+                reserved.sequence.store(position + 1, std::memory_order_release);
+            }
+        };
+
+        static std::size_t ring_size(std::size_t capacity) {
+            std::size_t size = 2;
+            while (size < capacity) size *= 2;
+            return size;
+        }
+
+        template <typename S, typename... Args>
+        bool push(const S& separator, const Args&... seq) {
+            std::size_t position = reserved_end.load(std::memory_order_relaxed);
+            slot* reserved;
+            for (;;) {
+                reserved = &slots[position & mask];
+                const std::size_t sequence = reserved->sequence.load(std::memory_order_acquire);
+                const std::ptrdiff_t difference = std::ptrdiff_t(sequence) - std::ptrdiff_t(position);
+                if (difference == 0) {
+                    if (reserved_end.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                } else if (difference < 0) { // the drainer is a whole ring behind
+                    dropped_count.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                } else {
+                    position = reserved_end.load(std::memory_order_relaxed);
+                }
+            }
+
+            publisher published{*reserved, position, false};
+            fixed_string<SlotSize>& text = reserved->text;
+            text.resize(0);
+            const bool formatted = concat_impl_append<char>(text, separator, seq...);
+            if (text.size() == SlotSize || text.truncated()) {
+                truncated_count.fetch_add(1, std::memory_order_relaxed);
+                text.resize(SlotSize - 1);
+            }
+            if (formatted) text.push_back('\n');
+            published.complete = true;
+            return formatted;
+        }
+
+        template <typename Sink>
+        void drain(Sink sink) {
+            unsigned idle = 0;
+            for (;;) {
+                batch ready;
+                while (ready.count < batch::max_segments) {
+                    slot& next = slots[(drained_end + ready.count) & mask];
+                    if (next.sequence.load(std::memory_order_acquire) != drained_end + ready.count + 1) break;
+                    ready.text  [ready.count] = next.text.data();
+                    ready.length[ready.count] = next.text.size();
+                    ready.count++;
+                }
+
+                if (ready.count) {
+                    concat_impl_flush(sink, ready);
+                    for (std::size_t i = 0; i < ready.count; i++, drained_end++) {
+                        slots[drained_end & mask].sequence.store(drained_end + mask + 1, std::memory_order_release);
+                    }
+                    idle = 0;
+                } else if (stopping.load(std::memory_order_acquire) && drained_end == reserved_end.load(std::memory_order_acquire)) {
+                    return;
+                } else if (++idle < 64) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        }
+
+    public:
+        // capacity is the number of slots, rounded up to a power of two
+        template <typename Sink, typename = enable_if_t<is_sink<Sink>::value, Sink>>
+        explicit concat_log(Sink sink, std::size_t capacity = 1024)
+            : slots(new slot[ring_size(capacity)]), mask(ring_size(capacity) - 1) {
+            for (std::size_t i = 0; i <= mask; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+            drainer = std::thread([this, sink] { drain(sink); });
+        }
+
+        concat_log(const concat_log&) = delete;
+        concat_log& operator=(const concat_log&) = delete;
+
+        // every message pushed before is written before returning
+        ~concat_log() {
+            stopping.store(true, std::memory_order_release);
+            drainer.join();
+        }
+
+        // messages lost because the ring was full, and messages cut to fit in their slot
+        std::size_t dropped()   const { return dropped_count  .load(std::memory_order_relaxed); }
+        std::size_t truncated() const { return truncated_count.load(std::memory_order_relaxed); }
+
+        // the same variants as concat_write. They return false when the ring was full or a parameter failed
+        template <typename... Args>
+        bool write(const separator_t<char>& sep, Args&&... seq) {
+            return push(sep.sep, std::forward<Args>(seq)...);
+        }
+
+        template <char head, char... tail, typename F, typename... Args,
+            typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+        bool write(F&& first, Args&&... rest) {
+            return push(char_separator<head, tail...>(), std::forward<F>(first), std::forward<Args>(rest)...);
+        }
+
+        template <const char* sep, typename F, typename... Args,
+            typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+        bool write(F&& first, Args&&... rest) {
+            return push(sep, std::forward<F>(first), std::forward<Args>(rest)...);
+        }
+
+        template <typename F, typename... Args,
+            typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+        bool write(F&& first, Args&&... rest) {
+            return push((const char*)nullptr, std::forward<F>(first), std::forward<Args>(rest)...);
+        }
+    };
+
+    template <std::size_t SlotSize>
+    constexpr std::size_t concat_log<SlotSize>::batch::max_segments;
+
+    // the concat_alloc variants return a std::basic_string whose memory comes from the given allocator
+    // (an arena, or a std::pmr::polymorphic_allocator). The allocator value type is the char type
+    template <typename Alloc>
+    using alloc_string = std::basic_string<typename Alloc::value_type, std::char_traits<typename Alloc::value_type>, Alloc>;
+
+    template <typename Alloc, typename CharT = typename Alloc::value_type, typename... Args>
+    alloc_string<Alloc> concat_alloc(const Alloc& alloc, const separator_t<CharT>& sep, Args&&... seq) {
+        alloc_string<Alloc> result(alloc);
+        concat_impl_append<CharT>(result, sep.sep, std::forward<Args>(seq)...);
+        return result;
+    }
+
+    template <char head, char... tail, typename Alloc, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    alloc_string<Alloc> concat_alloc(const Alloc& alloc, F&& first, Args&&... rest) {
+        alloc_string<Alloc> result(alloc);
+        concat_impl_append<char>(result, char_separator<head, tail...>(),
+                                 std::forward<F>(first), std::forward<Args>(rest)...);
+        return result;
+    }
+
+    template <const char* sep, typename Alloc, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    alloc_string<Alloc> concat_alloc(const Alloc& alloc, F&& first, Args&&... rest) {
+        alloc_string<Alloc> result(alloc);
+        concat_impl_append<char>(result, sep, std::forward<F>(first), std::forward<Args>(rest)...);
+        return result;
+    }
+
+    template <typename Alloc, typename F, typename... Args, typename CharT = typename Alloc::value_type,
+        typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
+    alloc_string<Alloc> concat_alloc(const Alloc& alloc, F&& first, Args&&... rest) {
+        alloc_string<Alloc> result(alloc);
+        concat_impl_append<CharT>(result, (const CharT*)nullptr, std::forward<F>(first), std::forward<Args>(rest)...);
+        return result;
+    }
+
+    template <typename CharT = char>
+    class concat_cache { // used by concat_interned, a bounded set of results shared between threads. It is split in
+                         // shards with their own lock, and each shard evicts with the CLOCK algorithm
+    public:
+        typedef std::shared_ptr<const std::basic_string<CharT>> handle;
+
+    private:
+        struct slot {
+            std::size_t hash;
+            std::string key;
+            handle      value;
+            bool        referenced; // read since the clock hand last passed
+        };
+
+        struct shard {
+            std::mutex                                   lock;
+            std::unordered_map<std::size_t, std::size_t> index; // hash of the key -> position in slots
+            std::vector<slot>                            slots;
+            std::size_t                                  hand      = 0;
+            std::size_t                                  hits      = 0;
+            std::size_t                                  misses    = 0;
+            std::size_t                                  evictions = 0;
+        };
+
+        std::unique_ptr<shard[]> shards;
+        std::size_t              shard_count;
+        std::size_t              shard_capacity;
+
+        template <typename F>
+        std::size_t total(F counter) const {
+            std::size_t sum = 0;
+            for (std::size_t i = 0; i < shard_count; i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                sum += counter(shards[i]);
+            }
+            return sum;
+        }
+
+        // 8 bytes per step, the keys are short and made of whole values
+        static std::size_t hash_of(const char* key, std::size_t n) {
+            std::uint64_t hash = n;
+            for (; n >= 8; key += 8, n -= 8) {
+                std::uint64_t word;
+                std::memcpy(&word, key, 8);
+                hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+                hash ^= hash >> 29;
+            }
+            std::uint64_t rest = 0;
+            std::memcpy(&rest, key, n);
+            hash = (hash ^ rest) * 0x9e3779b97f4a7c15ULL;
+            return std::size_t(hash ^ (hash >> 32));
+        }
+
+        // the slot that takes a new key: a free one, or the first one the clock hand finds unread since its last pass
+        static std::size_t victim(shard& s, std::size_t capacity) {
+            if (s.slots.size() < capacity) {
+                s.slots.push_back(slot());
+                return s.slots.size() - 1;
+            }
+            while (s.slots[s.hand].referenced) {
+                s.slots[s.hand].referenced = false;
+                s.hand = (s.hand + 1) % capacity;
+            }
+            const std::size_t position = s.hand;
+            s.hand = (s.hand + 1) % capacity;
+            s.index.erase(s.slots[position].hash);
+            s.evictions++;
+            return position;
+        }
+
+    public:
+        explicit concat_cache(std::size_t capacity = 4096, std::size_t shard_count = 16)
+            : shards(new shard[std::max<std::size_t>(shard_count, 1)]),
+              shard_count(std::max<std::size_t>(shard_count, 1)),
+              shard_capacity(std::max<std::size_t>((capacity + this->shard_count - 1) / this->shard_count, 1)) {}
+
+        concat_cache(const concat_cache&) = delete;
+        concat_cache& operator=(const concat_cache&) = delete;
+
+        // returns the result stored for key, or stores the one returned by format (called without holding the lock).
+        // The key is hashed once: the index holds hashes, and the slot keeps the key to tell collisions apart
+        template <typename Format>
+        handle intern(const char* key, std::size_t n, Format format) {
+            const std::size_t hash = hash_of(key, n);
+            shard& s = shards[(hash >> (sizeof(std::size_t) * 4)) % shard_count]; // the index buckets use the low bits
+            {
+                std::lock_guard<std::mutex> guard(s.lock);
+                const auto found = s.index.find(hash);
+                if (found != s.index.end() && s.slots[found->second].key.compare(0, std::string::npos, key, n) == 0) {
+                    slot& hit = s.slots[found->second];
+                    hit.referenced = true;
+                    s.hits++;
+                    return hit.value;
+                }
+                s.misses++;
+            }
+
+            handle value = std::make_shared<const std::basic_string<CharT>>(format());
+            std::lock_guard<std::mutex> guard(s.lock);
+            const auto found = s.index.find(hash);
+            std::size_t position;
+            if (found == s.index.end()) {
+                position = victim(s, shard_capacity);
+                s.index[hash] = position;
+            } else if (s.slots[found->second].key.compare(0, std::string::npos, key, n) == 0) {
+                return s.slots[found->second].value; // another thread stored it first
+            } else {
+                position = found->second;            // a different key with the same hash, it is replaced
+                s.evictions++;
+            }
+            slot& stored = s.slots[position];
+            stored.hash = hash;
+            stored.key.assign(key, n);
+            stored.value = value;
+            stored.referenced = false;
+            return value;
+        }
+
+        std::size_t hits()      const { return total([](const shard& s) { return s.hits;         }); }
+        std::size_t misses()    const { return total([](const shard& s) { return s.misses;       }); }
+        std::size_t evictions() const { return total([](const shard& s) { return s.evictions;    }); }
+        std::size_t size()      const { return total([](const shard& s) { return s.slots.size(); }); }
+        std::size_t capacity()  const { return shard_capacity * shard_count; }
+
+        void clear() {
+            for (std::size_t i = 0; i < shard_count; i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                shards[i].slots.clear();
+                shards[i].index.clear();
+                shards[i].hand = 0;
+            }
+        }
+    };
+
+    namespace { // interning keys : the parameters of concat_interned as bytes, formatting nothing
+
+        class intern_writer { // appends to memory already measured with a counting_buffer
+            char* position;
+
+        public:
+            explicit intern_writer(char* p) : position(p) {}
+
+            void append(const char* s, std::size_t n) {
+                std::memcpy(position, s, n);
+                position += n;
+            }
+        };
+
+        // every value is tagged with its kind, so parameters that print differently never share a key
+        template <typename K>
+        void intern_bytes(K& key, char tag, const void* p, std::size_t n) {
+            key.append(&tag, 1);
+            key.append(static_cast<const char*>(p), n);
+        }
+
+        template <typename K, typename CharT>
+        void intern_text(K& key, const CharT* s, std::size_t n) {
+            intern_bytes(key, 's', &n, sizeof(n));
+            key.append(reinterpret_cast<const char*>(s), n * sizeof(CharT));
+        }
+
+        template <typename CharT, typename K>
+        void intern_key(K& key, const CharT* s) {
+            if (s) intern_text(key, s, std::char_traits<CharT>::length(s));
+            else   intern_bytes(key, 'n', "", 0);
+        }
+
+        template <typename CharT, typename K, char head, char... tail>
+        void intern_key(K& key, const char_separator<head, tail...>&) {
+            intern_text(key, char_separator<head, tail...>::value, char_separator<head, tail...>::size);
+        }
+
+        template <typename CharT, typename K, typename T>
+            enable_if_t<is_string_of<CharT, T>::value,
+        void> intern_key(K& key, const T& s) {
+            intern_text(key, s.data(), s.size());
+        }
+
+        template <typename CharT, typename K, typename T>
+            enable_if_t<is_char_of<CharT, T>::value,
+        void> intern_key(K& key, const T& c) {
+            intern_bytes(key, 'c', &c, sizeof(c));
+        }
+
+        template <typename CharT, typename K, typename T>
+            enable_if_t<std::is_integral<T>::value && !is_character<T>::value && std::is_signed<T>::value,
+        void> intern_key(K& key, const T& i) {
+            const long long value = i;
+            intern_bytes(key, 'i', &value, sizeof(value));
+        }
+
+        template <typename CharT, typename K, typename T>
+            enable_if_t<std::is_integral<T>::value && !is_character<T>::value && !std::is_signed<T>::value,
+        void> intern_key(K& key, const T& u) {
+            const unsigned long long value = u;
+            intern_bytes(key, std::is_same<T, bool>::value ? 'b' : 'u', &value, sizeof(value));
+        }
+
+        // float is written as a double by the stream. long double has padding bytes, so it can't be a key
+        template <typename CharT, typename K, typename T>
+            enable_if_t<std::is_same<T, float>::value || std::is_same<T, double>::value,
+        void> intern_key(K& key, const T& f) {
+            const double value = f;
+            intern_bytes(key, 'f', &value, sizeof(value));
+        }
+
+        template <typename CharT, typename K, typename T, typename... Args>
+        void intern_key(K& key, const T& head, const Args&... tail) {
+            intern_key<CharT>(key, head);
+            intern_key<CharT>(key, tail...);
+        }
+
+        // the key is measured first and then written on the stack (on the heap when it is long), so a hit
+        // doesn't allocate
+        template <typename CharT, typename S, typename... Args>
+        typename concat_cache<CharT>::handle concat_impl_interned(concat_cache<CharT>& cache, const S& separator,
+                                                                  const Args&... seq) {
+            counting_buffer<char> counter;
+            intern_key<CharT>(counter, separator, seq...);
+
+            char local[256];
+            std::unique_ptr<char[]> spill(counter.size() > sizeof(local) ? new char[counter.size()] : nullptr);
+            char* key = spill ? spill.get() : local;
+            intern_writer writer(key);
+            intern_key<CharT>(writer, separator, seq...);
+            return cache.intern(key, counter.size(), [&] { return concat_impl<CharT>(separator, seq...); });
+        }
+    }
+
+    // the concat_interned variants return the result stored in the cache for the same parameters, and only format
+    // them on a miss. Parameters must be strings, chars, integers or floating point values (float or double)
+    template <typename CharT, typename... Args>
+    typename concat_cache<CharT>::handle concat_interned(concat_cache<CharT>& cache, const separator_t<CharT>& sep,
+                                                         const Args&... seq) {
+        return concat_impl_interned(cache, sep.sep, seq...);
+    }
+
+    template <char head, char... tail, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    concat_cache<char>::handle concat_interned(concat_cache<char>& cache, const F& first, const Args&... rest) {
+        return concat_impl_interned(cache, char_separator<head, tail...>(), first, rest...);
+    }
+
+    template <const char* sep, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    concat_cache<char>::handle concat_interned(concat_cache<char>& cache, const F& first, const Args&... rest) {
+        return concat_impl_interned(cache, sep, first, rest...);
+    }
+
+    template <typename CharT, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
+    typename concat_cache<CharT>::handle concat_interned(concat_cache<CharT>& cache, const F& first, const Args&... rest) {
+        return concat_impl_interned(cache, (const CharT*)nullptr, first, rest...);
+    }
+
+    namespace { // splitting : separators found in text, and tokens parsed back into values
+
+        // the first occurrence of the n characters of sep, or end
+        template <typename CharT>
+        const CharT* find_separator(const CharT* s, const CharT* end, const CharT* sep, std::size_t n) {
+            while (std::size_t(end - s) >= n) {
+                s = std::char_traits<CharT>::find(s, end - s - n + 1, sep[0]);
+                if (!s) return end;
+                if (std::char_traits<CharT>::compare(s + 1, sep + 1, n - 1) == 0) return s;
+                s++;
+            }
+            return end;
+        }
+
+#ifdef __SSE2__
+        // one character is found with memchr. Longer separators are found 16 positions at a time by matching their
+        // first and last characters, and only those candidates are compared
+        inline const char* find_separator(const char* s, const char* end, const char* sep, std::size_t n) {
+            if (s == end) return end; // memchr wants a valid pointer, and the text of a null cstring is null
+            if (n == 1) {
+                const void* found = std::memchr(s, sep[0], end - s);
+                return found ? static_cast<const char*>(found) : end;
+            }
+            const __m128i first = _mm_set1_epi8(sep[0]);
+            const __m128i last  = _mm_set1_epi8(sep[n - 1]);
+            for (; std::size_t(end - s) >= n - 1 + 16; s += 16) {
+                const __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+                const __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + n - 1));
+                for (unsigned mask = unsigned(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first),
+                                                                              _mm_cmpeq_epi8(tail, last))));
+                     mask; mask &= mask - 1) {
+                    const char* candidate = s + __builtin_ctz(mask);
+                    if (std::memcmp(candidate + 1, sep + 1, n - 2) == 0) return candidate;
+                }
+            }
+            return find_separator<char>(s, end, sep, n);
+        }
+#endif
+
+        template <typename CharT>
+        [[noreturn]] void unconcat_fail(string_ref<CharT> token, const char* expected) {
+            std::string text;
+            for (std::size_t i = 0; i < token.size(); i++) text.push_back(token[i] < 0x80 ? char(token[i]) : '?');
+            throw std::invalid_argument(std::string("unconcat: \"") + text + "\" is not " + expected);
+        }
+
+        // like std::from_chars: an optional minus for signed types and decimal digits, nothing else
+        template <typename T, typename CharT>
+            enable_if_t<std::is_integral<T>::value && !is_character<T>::value && !std::is_same<T, bool>::value,
+        void> unconcat_parse(string_ref<CharT> token, T& value) {
+            typedef typename std::make_unsigned<T>::type U;
+            const bool negative = std::is_signed<T>::value && !token.empty() && token[0] == CharT('-');
+            const U limit = negative ? U(U(std::numeric_limits<T>::max()) + 1) : U(std::numeric_limits<T>::max());
+            std::size_t i = negative;
+            if (i == token.size()) unconcat_fail(token, "an integer");
+            U magnitude = 0;
+            for (; i < token.size(); i++) {
+                if (token[i] < CharT('0') || token[i] > CharT('9')) unconcat_fail(token, "an integer");
+                const U digit = U(token[i] - CharT('0'));
+                if (magnitude > (limit - digit) / 10) {
+                    throw std::out_of_range("unconcat: integer out of range");
+                }
+                magnitude = U(magnitude * 10 + digit);
+            }
+            value = negative ? T(U(0) - magnitude) : T(magnitude);
+        }
+
+        template <typename T, typename CharT>
+            enable_if_t<std::is_same<T, bool>::value,
+        void> unconcat_parse(string_ref<CharT> token, T& value) { // concat writes them as 1 and 0
+            if (token.size() != 1 || (token[0] != CharT('0') && token[0] != CharT('1'))) unconcat_fail(token, "a bool");
+            value = token[0] == CharT('1');
+        }
+
+        template <typename T, typename CharT>
+            enable_if_t<is_char_of<CharT, T>::value,
+        void> unconcat_parse(string_ref<CharT> token, T& value) {
+            if (token.size() != 1) unconcat_fail(token, "a character");
+            value = T(token[0]);
+        }
+
+        inline void unconcat_strto(const char* s, char** end, float&       value) { value = std::strtof (s, end); }
+        inline void unconcat_strto(const char* s, char** end, double&      value) { value = std::strtod (s, end); }
+        inline void unconcat_strto(const char* s, char** end, long double& value) { value = std::strtold(s, end); }
+
+        // the grammar of std::from_chars: an optional minus, then inf, infinity, nan, or decimal digits with an
+        // optional point and exponent. No plus, spaces or hex, which strtod would take
+        inline bool is_decimal_text(const char* s, std::size_t n) {
+            std::size_t i = n && s[0] == '-';
+            auto rest_is = [&](const char* word) {
+                if (n - i != std::strlen(word)) return false;
+                for (std::size_t k = i; k < n; k++) if ((s[k] | 0x20) != word[k - i]) return false;
+                return true;
+            };
+            if (rest_is("inf") || rest_is("infinity") || rest_is("nan")) return true;
+
+            auto digits = [&] {
+                const std::size_t start = i;
+                while (i < n && s[i] >= '0' && s[i] <= '9') i++;
+                return i - start;
+            };
+            std::size_t mantissa = digits();
+            if (i < n && s[i] == '.') {
+                i++;
+                mantissa += digits();
+            }
+            if (!mantissa) return false;
+            if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+                i++;
+                if (i < n && (s[i] == '+' || s[i] == '-')) i++;
+                if (!digits()) return false;
+            }
+            return i == n;
+        }
+
+        // the token is checked and copied to the stack, as strtod needs a terminated string. concat writes '.'
+        // whatever LC_NUMERIC is (see classic_decimal_point), so it is swapped for the point strtod expects
+        template <typename T, typename CharT>
+            enable_if_t<std::is_floating_point<T>::value,
+        void> unconcat_parse(string_ref<CharT> token, T& value) {
+            char local[64];
+            std::unique_ptr<char[]> spill(token.size() >= sizeof(local) ? new char[token.size() + 1] : nullptr);
+            char* text = spill ? spill.get() : local;
+            for (std::size_t i = 0; i < token.size(); i++) {
+                if (token[i] <= CharT(' ') || token[i] >= CharT(0x7f)) unconcat_fail(token, "a number");
+                text[i] = char(token[i]);
+            }
+            text[token.size()] = '\0';
+            if (!is_decimal_text(text, token.size())) unconcat_fail(token, "a number");
+
+            std::string localized;
+            const char* point = std::localeconv()->decimal_point;
+            if (point[0] != '.' || point[1]) {
+                for (std::size_t i = 0; i < token.size(); i++) {
+                    if (text[i] == '.') localized += point;
+                    else localized += text[i];
+                }
+            }
+            const char* begin = localized.empty() ? text : localized.c_str();
+
+            char* end = nullptr;
+            errno = 0;
+            unconcat_strto(begin, &end, value);
+            if (*end) unconcat_fail(token, "a number");
+            if (errno == ERANGE && std::isinf(value)) throw std::out_of_range("unconcat: number out of range");
+        }
+
+        template <typename T, typename CharT>
+            enable_if_t<is_specialization_of<T, std::basic_string>::value,
+        void> unconcat_parse(string_ref<CharT> token, T& value) {
+            value.assign(token.data(), token.size());
+        }
+
+        template <typename T, typename CharT>
+            enable_if_t<std::is_same<T, string_ref<CharT>>::value,
+        void> unconcat_parse(string_ref<CharT> token, T& value) {
+            value = token;
+        }
+
+        [[noreturn]] inline void unconcat_count_fail() {
+            throw std::invalid_argument("unconcat: the number of tokens doesn't match the number of types");
+        }
+
+        template <std::size_t I, typename It, typename... T>
+            enable_if_t<I == sizeof...(T),
+        void> unconcat_each(std::tuple<T...>&, It&, const It&) {}
+
+        template <std::size_t I, typename It, typename... T>
+            enable_if_t<I < sizeof...(T),
+        void> unconcat_each(std::tuple<T...>& values, It& token, const It& end) {
+            if (token == end) unconcat_count_fail();
+            unconcat_parse(*token, std::get<I>(values));
+            unconcat_each<I + 1>(values, ++token, end);
+        }
+    }
+
+    template <typename CharT = char>
+    class split_range { // result of split, the tokens are found while it is iterated
+        const CharT* text;
+        const CharT* text_end;
+        const CharT* sep;
+        std::size_t  sep_size;
+
+    public:
+        // iterators hold what they need themselves, so they only depend on the text, not on the range
+        class iterator {
+            const CharT* position = nullptr; // start of the token
+            const CharT* next     = nullptr; // end of the token, where the separator was found
+            const CharT* text_end = nullptr;
+            const CharT* sep      = nullptr;
+            std::size_t  sep_size = 0;
+            bool         finished = true;
+
+            const CharT* find(const CharT* from) const {
+                if (!sep_size) return text_end; // an empty separator never splits
+                return find_separator(from, text_end, sep, sep_size);
+            }
+
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef string_ref<CharT>         value_type;
+            typedef std::ptrdiff_t            difference_type;
+            typedef const string_ref<CharT>*  pointer;
+            typedef string_ref<CharT>         reference;
+
+            iterator() {}
+            iterator(const CharT* text, const CharT* text_end, const CharT* sep, std::size_t sep_size)
+                : position(text), text_end(text_end), sep(sep), sep_size(sep_size), finished(false) {
+                next = find(text);
+            }
+
+            string_ref<CharT> operator*() const { return string_ref<CharT>(position, next - position); }
+
+            iterator& operator++() {
+                if (next == text_end) finished = true;
+                else next = find(position = next + sep_size);
+                return *this;
+            }
+            iterator operator++(int) { iterator old = *this; ++*this; return old; }
+
+            friend bool operator==(const iterator& a, const iterator& b) {
+                return a.finished == b.finished && (a.finished || a.position == b.position);
+            }
+            friend bool operator!=(const iterator& a, const iterator& b) { return !(a == b); }
+        };
+
+        split_range(string_ref<CharT> text, const CharT* sep)
+            : text(text.data()), text_end(text.data() + text.size()),
+              sep(sep), sep_size(sep ? std::char_traits<CharT>::length(sep) : 0) {}
+
+        iterator begin() const { return iterator(text, text_end, sep, sep_size); }
+        iterator end()   const { return iterator(); }
+    };
+
+    // the split variants find the tokens of a text joined with the same separator, without copying them. The text
+    // must outlive the range, and text without separators is a single token (even when it is empty)
+    template <typename CharT, typename T>
+    split_range<CharT> split(const T& text, const separator_t<CharT>& sep) {
+        return split_range<CharT>(string_ref<CharT>(text), sep.sep);
+    }
+
+    template <char head, char... tail, typename T>
+    split_range<char> split(const T& text) {
+        return split_range<char>(string_ref<char>(text), char_separator<head, tail...>::value);
+    }
+
+    // the inverse of concat: the tokens of text are parsed as integers, floating point values, bools (1 or 0),
+    // characters, strings or string_refs. Throws std::invalid_argument when a token can't be parsed or there isn't
+    // one per type, and std::out_of_range when a number doesn't fit
+    template <typename... T, typename CharT, typename Text>
+    std::tuple<T...> unconcat(const Text& text, const separator_t<CharT>& sep) {
+        std::tuple<T...> values;
+        const split_range<CharT> tokens = split(text, sep);
+        auto token = tokens.begin();
+        unconcat_each<0>(values, token, tokens.end());
+        if (token != tokens.end()) unconcat_count_fail();
+        return values;
+    }
+
+    namespace { // hashing and comparing : the text of the parameters consumed as it is produced
+
+        template <typename CharT, typename S, typename... Args>
+        std::uint64_t concat_impl_hash(const S& separator, const Args&... seq) {
+            hashing_buffer<CharT> buffer;
+            concat_impl_append<CharT>(buffer, separator, seq...);
+            return buffer.digest();
+        }
+
+        // a failed parameter leaves the result of concat empty, so only an empty candidate needs every parameter
+        // to be written. Any other stops at the first difference
+        template <typename CharT, typename S, typename... Args>
+        bool concat_impl_equals(string_ref<CharT> candidate, const S& separator, const Args&... seq) {
+            if (candidate.empty()) {
+                counting_buffer<CharT> counter;
+                return !concat_impl_append<CharT>(counter, separator, seq...) || counter.size() == 0;
+            }
+            comparing_buffer<CharT> buffer(candidate.data(), candidate.size());
+            return concat_impl_append<CharT>(buffer, separator, seq...) && buffer.equal();
+        }
+    }
+
+    // the concat_hash variants return the XXH64 of the bytes of the result of concat with the same parameters,
+    // without building it. concat_hash(key) hashes a stored string the same way
+    template <typename CharT, typename... Args>
+    std::uint64_t concat_hash(const separator_t<CharT>& sep, const Args&... seq) {
+        return concat_impl_hash<CharT>(sep.sep, seq...);
+    }
+
+    template <char head, char... tail, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    std::uint64_t concat_hash(const F& first, const Args&... rest) {
+        return concat_impl_hash<char>(char_separator<head, tail...>(), first, rest...);
+    }
+
+    template <const char* sep, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    std::uint64_t concat_hash(const F& first, const Args&... rest) {
+        return concat_impl_hash<char>(sep, first, rest...);
+    }
+
+    template <typename CharT = char, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
+    std::uint64_t concat_hash(const F& first, const Args&... rest) {
+        return concat_impl_hash<CharT>((const CharT*)nullptr, first, rest...);
     }
 
-    // 5. entry point,  when the separator is std::endl passed as template argument
-    template <std::ostream& sep (std::ostream&), typename CharT = char, typename F, typename... Args,
+    // the concat_equals variants tell whether candidate is the result of concat with the same parameters. They
+    // stop at the first character that differs, and build nothing
+    template <typename CharT, typename T, typename... Args>
+    bool concat_equals(const T& candidate, const separator_t<CharT>& sep, const Args&... seq) {
+        return concat_impl_equals<CharT>(string_ref<CharT>(candidate), sep.sep, seq...);
+    }
+
+    template <char head, char... tail, typename T, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    bool concat_equals(const T& candidate, const F& first, const Args&... rest) {
+        return concat_impl_equals<char>(string_ref<char>(candidate), char_separator<head, tail...>(), first, rest...);
+    }
+
+    template <const char* sep, typename T, typename F, typename... Args,
+        typename = enable_if_t<!std::is_same<F, separator_t<char>>::value, F>>
+    bool concat_equals(const T& candidate, const F& first, const Args&... rest) {
+        return concat_impl_equals<char>(string_ref<char>(candidate), sep, first, rest...);
+    }
+
+    template <typename CharT = char, typename T, typename F, typename... Args,
         typename = enable_if_t<!std::is_same<F, separator_t<CharT>>::value, F>>
-    std::basic_string<CharT> concat(F&& first, Args&&... rest) {
-        return concat_impl<CharT>(
-            sep,
-            std::forward<F>(first),
-            std::forward<Args>(rest)...
-        );
+    bool concat_equals(const T& candidate, const F& first, const Args&... rest) {
+        return concat_impl_equals<CharT>(string_ref<CharT>(candidate), (const CharT*)nullptr, first, rest...);
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,436 @@
+#include "../concat.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <codecvt>
+#include <deque>
+#include <locale>
+#include <mutex>
+#include <thread>
+#include <new>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace theypsilon;
+using namespace std;
+
+// every allocation of the process goes through here, so each benchmark can report its allocations per operation.
+// The workers of parallel() and the concat_log drainer allocate too, so the counters are atomic
+static atomic<size_t> allocations{0};
+static atomic<size_t> allocated_bytes{0};
+
+void* operator new(size_t size) {
+	allocations.fetch_add(1, memory_order_relaxed);
+	allocated_bytes.fetch_add(size, memory_order_relaxed);
+	if (void* p = malloc(size ? size : 1)) return p;
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+// gcc sees free() paired with operator new once both are inlined, but the replaced new does call malloc
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+static double budget_ms = 20;   // minimum time spent on each benchmark
+static size_t sink = 0;         // keeps the results alive
+
+template <typename F>
+void bench(const char* scenario, const char* variant, F operation) {
+	typedef chrono::steady_clock clock;
+	size_t iterations = 0;
+	const size_t start_allocations = allocations.load(), start_bytes = allocated_bytes.load();
+	const auto start = clock::now();
+	auto elapsed = clock::duration::zero();
+	for (size_t batch = 1; chrono::duration<double, milli>(elapsed).count() < budget_ms; batch *= 2) {
+		for (size_t i = 0; i < batch; i++) sink += operation();
+		iterations += batch;
+		elapsed = clock::now() - start;
+	}
+
+	printf("%-34s %-16s %14.1f %12.2f %14.1f\n", scenario, variant,
+	       chrono::duration<double, nano>(elapsed).count() / iterations,
+	       double(allocations - start_allocations) / iterations,
+	       double(allocated_bytes - start_bytes) / iterations);
+}
+
+// hand-written baselines
+template <typename T>
+void stream_join(ostringstream& out, const vector<T>& v, const char* sep) {
+	for (size_t i = 0; i < v.size(); i++) {
+		if (i) out << sep;
+		out << v[i];
+	}
+}
+
+size_t snprintf_join(const vector<int>& v) {
+	string result;
+	char buffer[16];
+	for (size_t i = 0; i < v.size(); i++) {
+		if (i) result += ',';
+		result.append(buffer, snprintf(buffer, sizeof(buffer), "%d", v[i]));
+	}
+	return result.size();
+}
+
+size_t snprintf_join(const vector<double>& v) {
+	string result;
+	char buffer[32];
+	for (size_t i = 0; i < v.size(); i++) {
+		if (i) result += ',';
+		result.append(buffer, snprintf(buffer, sizeof(buffer), "%g", v[i]));
+	}
+	return result.size();
+}
+
+template <typename T>
+vector<T> sequence(size_t n, T start, T step) {
+	vector<T> v;
+	for (size_t i = 0; i < n; i++) v.push_back(start + T(i) * step);
+	return v;
+}
+
+void entry_points() {
+	const string path = "/api/v1/users";
+	const int id = 123456;
+	const double elapsed = 12.375;
+
+	bench("1. separator_t", "concat", [&] { return concat(separator(", "), "GET", path, id, elapsed).size(); });
+	bench("2. char-pack separator", "concat", [&] { return concat<',', ' '>("GET", path, id, elapsed).size(); });
+	bench("3. const char* separator", "concat", [&] { return concat<sep::comma>("GET", path, id, elapsed).size(); });
+	bench("4. no separator", "concat", [&] { return concat("GET ", path, " id=", id, " t=", elapsed).size(); });
+	bench("5. std::endl separator", "concat", [&] { return concat<endl>("GET", path, id, elapsed).size(); });
+	bench("   same text", "ostringstream", [&] {
+		ostringstream s;
+		s << "GET" << ", " << path << ", " << id << ", " << elapsed;
+		return s.str().size();
+	});
+	bench("   same text", "snprintf", [&] {
+		char buffer[128];
+		return size_t(snprintf(buffer, sizeof(buffer), "GET, %s, %d, %g", path.c_str(), id, elapsed));
+	});
+	bench("   same text", "concat_into", [&] {
+		static string reused;
+		reused.clear();
+		return concat_into(reused, separator(", "), "GET", path, id, elapsed).size();
+	});
+	bench("   same text", "concat_n<64>", [&] { return concat_n<64>(separator(", "), "GET", path, id, elapsed).size(); });
+	bench("   same text", "concat_deferred", [&] {
+		static vector<concat_record<>> queue; // the capture only, formatting happens elsewhere
+		if (queue.size() == 1024) queue.clear();
+		queue.push_back(concat_deferred(separator(", "), "GET", path, id, elapsed));
+		return queue.size();
+	});
+	bench("literal metric prefix", "concat_c", [&] {
+		static constexpr auto prefix = concat_c<'.'>("app", "http", "requests", integral_constant<int, 200>());
+		return prefix.size();
+	});
+	bench("literal metric prefix", "concat", [&] { return concat<'.'>("app", "http", "requests", 200).size(); });
+	{
+		concat_cache<> cache;
+		const string service = "checkout", region = "eu-west-1";
+		bench("repeated metric name", "concat_interned", [&] {
+			return concat_interned(cache, separator("."), service, region, "latency", id)->size();
+		});
+		bench("repeated metric name", "concat", [&] { return concat(separator("."), service, region, "latency", id).size(); });
+	}
+
+	{
+		const string service = "checkout", region = "eu-west-1";
+		const string key = concat(separator("."), service, region, "latency", id);
+		bench("metric key lookup", "concat_hash", [&] {
+			return size_t(concat_hash(separator("."), service, region, "latency", id));
+		});
+		bench("metric key lookup", "hash of concat", [&] {
+			return hash<string>()(concat(separator("."), service, region, "latency", id));
+		});
+		bench("metric key lookup", "concat_equals", [&] {
+			return size_t(concat_equals(key, separator("."), service, region, "latency", id));
+		});
+		bench("metric key lookup", "== concat", [&] {
+			return size_t(key == concat(separator("."), service, region, "latency", id));
+		});
+	}
+
+	const string record = concat<','>("checkout", "eu-west-1", id, elapsed, "ok");
+	bench("parse record", "unconcat", [&] {
+		return get<0>(unconcat<string_ref<>, string, int, double, string>(record, separator(","))).size();
+	});
+	bench("parse record", "istringstream", [&] {
+		istringstream in(record);
+		string service, region, status;
+		int code;
+		double time;
+		getline(in, service, ',');
+		getline(in, region, ',');
+		in >> code;
+		in.ignore();
+		in >> time;
+		in.ignore();
+		getline(in, status);
+		return service.size();
+	});
+
+	FILE* null = fopen("/dev/null", "w");
+	const string user_agent(200, 'u');
+	bench("access log line", "concat_write", [&] {
+		return size_t(concat_write<' '>(fileno(null), "GET", path, id, elapsed, user_agent, '\n'));
+	});
+	bench("access log line", "concat + write", [&] {
+		const string line = concat<' '>("GET", path, id, elapsed, user_agent, '\n');
+		return size_t(write(fileno(null), line.data(), line.size()));
+	});
+	const string body(65536, 'b');
+	bench("response with 64KB body", "concat_write", [&] {
+		return size_t(concat_write(fileno(null), "HTTP/1.1 200 OK\r\nContent-Length: ", body.size(), "\r\n\r\n", body));
+	});
+	bench("response with 64KB body", "concat + write", [&] {
+		const string response = concat("HTTP/1.1 200 OK\r\nContent-Length: ", body.size(), "\r\n\r\n", body);
+		return size_t(write(fileno(null), response.data(), response.size()));
+	});
+
+	{
+		concat_log<> log(fileno(null), 4096);
+		bench("log message", "concat_log", [&] {
+			while (!log.write<' '>("GET", path, id, elapsed)) this_thread::yield(); // the ring is full
+			return size_t(1);
+		});
+	}
+	mutex queue_lock;
+	deque<string> queue;
+	bench("log message", "concat + mutex", [&] {
+		string message = concat<' '>("GET", path, id, elapsed);
+		lock_guard<mutex> lock(queue_lock);
+		queue.push_back(move(message));
+		if (queue.size() > 4096) queue.clear();
+		return queue.size();
+	});
+	fclose(null);
+}
+
+struct Point {
+	int x, y;
+	friend ostream& operator<<(ostream& out, const Point& p) { return out << '(' << p.x << ", " << p.y << ')'; }
+};
+
+void scalars() {
+	const int i = -1234567;
+	const double d = 3.14159265358979;
+	const Point p = { 3, -4 };
+
+	bench("case 1: int", "concat", [&] { return concat(i).size(); });
+	bench("case 1: int", "ostringstream", [&] {
+		ostringstream s;
+		s << i;
+		return s.str().size();
+	});
+	bench("case 1: int", "snprintf", [&] {
+		char buffer[16];
+		return size_t(snprintf(buffer, sizeof(buffer), "%d", i));
+	});
+
+	bench("case 1: double", "concat", [&] { return concat(d).size(); });
+	bench("case 1: double roundtrip", "concat", [&] { return concat(roundtrip, d).size(); });
+	bench("case 1: double", "ostringstream", [&] {
+		ostringstream s;
+		s << d;
+		return s.str().size();
+	});
+	bench("case 1: double", "snprintf", [&] {
+		char buffer[32];
+		return size_t(snprintf(buffer, sizeof(buffer), "%g", d));
+	});
+
+	bench("case 1: user type", "concat", [&] { return concat("at ", p).size(); });
+	bench("case 1: user type", "ostringstream", [&] {
+		ostringstream s;
+		s << "at " << p;
+		return s.str().size();
+	});
+}
+
+void strings() {
+	const char* small = "hello";
+	const string large(4096, 'x');
+
+	bench("case 2: small cstrings x4", "concat", [&] { return concat(small, small, small, small).size(); });
+	bench("case 2: small cstrings x4", "ostringstream", [&] {
+		ostringstream s;
+		s << small << small << small << small;
+		return s.str().size();
+	});
+	bench("case 2: small cstrings x4", "snprintf", [&] {
+		char buffer[32];
+		return size_t(snprintf(buffer, sizeof(buffer), "%s%s%s%s", small, small, small, small));
+	});
+
+	bench("case 1: 4KB strings x2", "concat", [&] { return concat(large, large).size(); });
+	bench("case 1: 4KB strings x2", "ostringstream", [&] {
+		ostringstream s;
+		s << large << large;
+		return s.str().size();
+	});
+	bench("case 1: 4KB strings x2", "std::string +", [&] { return (large + large).size(); });
+
+	const string message = string(200, 'm') + "\"quoted\"\n" + string(200, 'm');
+	bench("case 2: JSON field, 400 chars", "escape::json", [&] { return concat(escape::json, message).size(); });
+	bench("case 2: JSON field, 400 chars", "escape + concat", [&] {
+		string escaped;
+		for (char c : message) {
+			if (c == '"' || c == '\\') escaped += '\\', escaped += c;
+			else if (c == '\n') escaped += "\\n";
+			else escaped += c;
+		}
+		return concat(escaped).size();
+	});
+
+	const string comment = string(100, 'c') + ", \"quoted\" " + string(100, 'c');
+	bench("case 2: CSV row, 4 fields", "escape::csv", [&] {
+		return concat<','>(escape::csv, "jdoe", 42, comment, 3.5).size();
+	});
+	bench("case 2: CSV row, 4 fields", "quote + concat", [&] {
+		string quoted;
+		if (comment.find_first_of(",\"\r\n") == string::npos) quoted = comment;
+		else {
+			quoted += '"';
+			for (char c : comment) {
+				if (c == '"') quoted += '"';
+				quoted += c;
+			}
+			quoted += '"';
+		}
+		return concat<','>("jdoe", 42, quoted, 3.5).size();
+	});
+
+	const u16string utf16 = u16string(4000, u'x') + u"\u00e9\u20ac";
+	bench("case 2: 4KB u16string to UTF-8", "concat", [&] { return concat<char>(utf16).size(); });
+	bench("case 2: 4KB u16string to UTF-8", "wstring_convert", [&] {
+		wstring_convert<codecvt_utf8_utf16<char16_t>, char16_t> convert;
+		return convert.to_bytes(utf16).size();
+	});
+}
+
+void streams() {
+	ostringstream guest;
+	for (int i = 0; i < 10000; i++) guest << i;
+	const ostringstream& g = guest;
+
+	bench("case 3: 38KB guest stream", "concat", [&] { return concat("guest: ", g).size(); });
+	bench("case 3: 38KB guest stream", "ostringstream", [&] {
+		ostringstream s;
+		s << "guest: " << g.str();
+		return s.str().size();
+	});
+
+	bench("host stream overload", "concat", [&] {
+		static ostringstream host;
+		host.str("");
+		return concat<' '>(host, "GET", 123456, 12.375).size();
+	});
+	bench("host stream overload", "ostringstream", [&] {
+		static ostringstream host;
+		host.str("");
+		host << "GET" << ' ' << 123456 << ' ' << 12.375;
+		return host.str().size();
+	});
+}
+
+void containers() {
+	for (size_t n : {size_t(10), size_t(1000), size_t(1000000)}) {
+		const vector<int> ints = sequence<int>(n, -500, 7);
+		const vector<double> doubles = sequence<double>(n, 0.5, 1.25);
+		char scenario[64];
+
+		snprintf(scenario, sizeof(scenario), "case 4: vector<int> x%zu", n);
+		bench(scenario, "concat", [&] { return concat<','>(ints).size(); });
+		bench(scenario, "concat parallel", [&] { return concat<','>(parallel(ints)).size(); });
+		bench(scenario, "ostringstream", [&] {
+			ostringstream s;
+			stream_join(s, ints, ",");
+			return s.str().size();
+		});
+		bench(scenario, "snprintf", [&] { return snprintf_join(ints); });
+
+		snprintf(scenario, sizeof(scenario), "case 4: vector<double> x%zu", n);
+		bench(scenario, "concat", [&] { return concat<','>(doubles).size(); });
+		bench(scenario, "concat parallel", [&] { return concat<','>(parallel(doubles)).size(); });
+		bench(scenario, "ostringstream", [&] {
+			ostringstream s;
+			stream_join(s, doubles, ",");
+			return s.str().size();
+		});
+		bench(scenario, "snprintf", [&] { return snprintf_join(doubles); });
+	}
+
+	for (size_t n : {size_t(1000), size_t(100000)}) {
+		vector<string> words;
+		for (size_t i = 0; i < n; i++) words.push_back(concat("'word", i, "'"));
+		char scenario[64];
+
+		snprintf(scenario, sizeof(scenario), "case 4: vector<string> x%zu", n);
+		bench(scenario, "concat", [&] { return concat<',', ' '>(words).size(); });
+		bench(scenario, "ostringstream", [&] {
+			ostringstream s;
+			stream_join(s, words, ", ");
+			return s.str().size();
+		});
+		bench(scenario, "std::string +=", [&] {
+			string s;
+			for (size_t i = 0; i < words.size(); i++) {
+				if (i) s += ", ";
+				s += words[i];
+			}
+			return s.size();
+		});
+	}
+}
+
+void tuples() {
+	const auto nested = make_tuple(1, "two", make_tuple(3.5, 'c', make_tuple(string("deep"), 42u)));
+	const auto pair = make_pair(string("key"), 1234);
+
+	bench("case 5: nested tuples", "concat", [&] { return concat<' '>(nested).size(); });
+	bench("case 5: nested tuples", "ostringstream", [&] {
+		ostringstream s;
+		s << get<0>(nested) << ' ' << get<1>(nested) << ' ' << get<0>(get<2>(nested)) << ' '
+		  << get<1>(get<2>(nested)) << ' ' << get<0>(get<2>(get<2>(nested))) << ' ' << get<1>(get<2>(get<2>(nested)));
+		return s.str().size();
+	});
+	bench("case 6: pair", "concat", [&] { return concat<'='>(pair).size(); });
+	bench("case 6: pair", "ostringstream", [&] {
+		ostringstream s;
+		s << pair.first << '=' << pair.second;
+		return s.str().size();
+	});
+}
+
+// usage: bench [milliseconds per benchmark]
+int main(int argc, char* argv[]) {
+	if (argc > 1) budget_ms = atof(argv[1]);
+
+	printf("%-34s %-16s %14s %12s %14s\n", "scenario", "variant", "ns/op", "allocs/op", "bytes/op");
+	entry_points();
+	scalars();
+	strings();
+	streams();
+	containers();
+	tuples();
+	return sink == 0;
+}
@@ -43,8 +43,8 @@ void run(int yes)
 	RUN() { concat("yeah", string{}); }	
 #endif
 
-#ifdef TEST_FAIL_CHAR_WSTRING
-	RUN() { concat<char>(wstring(L"nope")); }
+#ifdef TEST_SUCCESS_CHAR_WSTRING
+	RUN() { concat<char>(wstring(L"yeah")); }
 #endif
 
 #ifdef TEST_FAIL_ENDL1
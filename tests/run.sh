@@ -11,7 +11,7 @@ echo ""
 echo "UNIT TESTS"
 echo "----------"
 
-$CXX unit.cpp -std=c++11 -lm -lstdc++
+$CXX unit.cpp -std=c++11 -pthread -lm -lstdc++
 ./a.out
 
 echo "LINKER TEST"
@@ -28,4 +28,12 @@ echo ""
 echo "COMPILER TESTS"
 echo "--------------"
 
-./compile_tester.sh
\ No newline at end of file
+./compile_tester.sh
+
+echo ""
+echo "BENCHMARK"
+echo "---------"
+
+$CXX bench.cpp -std=c++11 -O2 -pthread -lm -lstdc++ -o bench.out
+./bench.out $BENCH_MS
+rm bench.out
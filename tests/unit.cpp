@@ -11,6 +11,11 @@
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
+#include <random>
+#include <fstream>
+#include <clocale>
+#include <thread>
+#include <unistd.h>
 
 using namespace theypsilon;
 using namespace std;
@@ -355,4 +360,927 @@ TEST_CASE( "User defined type overload, mixed", "user" ) {
 	CHECK( concat<wchar_t >(UserDefinedType<wchar_t >(L"UserDefinedType")) == L"UserDefinedType" );
 	CHECK( concat<char16_t>(UserDefinedType<char16_t>(u"UserDefinedType")) == u"UserDefinedType" );
 	CHECK( concat<char32_t>(UserDefinedType<char32_t>(U"UserDefinedType")) == U"UserDefinedType" );
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Direct writer, same output as streams", "direct_writer" ) {
+	CHECK( concat(-2147483647 - 1, ' ', 18446744073709551615ull) == "-2147483648 18446744073709551615" );
+	CHECK( concat(static_cast<short>(-5), static_cast<unsigned char>('a')) == "-5a" );
+	CHECK( concat<' '>(1e300, -0.0, 1.0/3.0, 2.5L) == "1e+300 -0 0.333333 2.5" );
+	CHECK( concat<' '>(hex, 255, dec, 255) == "ff 255" );
+	CHECK( concat(setw(3), 1, 2) == "  12" );
+	CHECK( concat(boolalpha, true, noboolalpha, true) == "true1" );
+	CHECK( concat<endl>(UserDefinedType<char>("a"), 1.5, "b") == "a\n1.5\nb" );
+	CHECK( concat<wchar_t>(1, L'a', 2.5, L"b") == L"1a2.5b" );
+}
+
+// switches LC_NUMERIC to a locale whose decimal point is ',', built here with localedef so every machine has it
+bool set_comma_numeric_locale() {
+	static string path;
+	if (path.empty()) {
+		char dir[] = "/tmp/concat_locale_XXXXXX";
+		if (!mkdtemp(dir)) return false;
+		path = dir;
+		ofstream(path + "/comma.src") << "LC_NUMERIC\ndecimal_point \"<U002C>\"\nthousands_sep \"\"\ngrouping -1\nEND LC_NUMERIC\n";
+		ofstream(path + "/ascii.map") << "<code_set_name> ANSI_X3.4-1968\nCHARMAP\n<U002C> \\x2c\nEND CHARMAP\n";
+		// localedef complains about the categories left out and fails, but writes LC_NUMERIC
+		const int status = system(concat("localedef -c -i ", path, "/comma.src -f ", path, "/ascii.map ", path,
+		                                 "/comma >/dev/null 2>&1").c_str());
+		(void) status;
+	}
+	setenv("LOCPATH", path.c_str(), 1);
+	const bool found = setlocale(LC_NUMERIC, "comma") != nullptr;
+	unsetenv("LOCPATH");
+	return found;
+}
+
+TEST_CASE( "Direct writer, the same text whatever LC_NUMERIC is", "direct_writer_locale" ) {
+	REQUIRE( set_comma_numeric_locale() );
+	char printed[8];
+	snprintf(printed, sizeof(printed), "%g", 1.5);
+	CHECK( string(printed) == "1,5" );
+
+	CHECK( concat<' '>(1.5, -2.5e-7, 0.5L, 1e300) == "1.5 -2.5e-07 0.5 1e+300" );
+	CHECK( concat<' '>(roundtrip, 0.1, 1.0/3.0, 0.1L) == "0.1 0.3333333333333333 0.1" );
+	CHECK( concat<wchar_t>(2.5) == L"2.5" );
+	CHECK( concat(escape::csv, 1.5) == "1.5" );
+	CHECK( get<0>(unconcat<double>(concat(1.5), separator(","))) == 1.5 );
+	setlocale(LC_NUMERIC, "C");
+}
+
+TEST_CASE( "Size precomputation, exact for text and integers", "size" ) {
+	vector<string> s = {"hello", "world", "!"};
+	auto t = make_tuple(-123, "abc", make_pair(string("de"), 'f'), vector<int>{10, 200, 3000});
+	CHECK( concat_impl_size_element<char>(", ", s, t, 0, true) == concat(separator(", "), s, t, 0, true).size() );
+	CHECK( concat_impl_size_element<char>(char_separator<' '>(), -9223372036854775807ll - 1, 18446744073709551615ull)
+			== concat<' '>(-9223372036854775807ll - 1, 18446744073709551615ull).size() );
+	CHECK( concat_impl_size_element<char>(static_cast<const char*>(nullptr), vector<int>{}, "") == 0 );
+	CHECK( concat_impl_size_element<char>(", ", 1.0/3.0) >= concat(1.0/3.0).size() );
+}
+
+struct PushBackOnly {
+	typedef char value_type;
+	string text;
+	void push_back(char c) { text.push_back(c); }
+	size_t size() const { return text.size(); }
+	void resize(size_t n) { text.resize(n); }
+};
+
+TEST_CASE( "concat_into, appends to caller-owned buffers", "concat_into" ) {
+	string s = "log: ";
+	CHECK( concat_into(s, "a", 1, 2.5) == "log: a12.5" );
+	CHECK( concat_into(s, separator(", "), 'b', 3) == "log: a12.5b, 3" );
+	CHECK( concat_into<' '>(s, "c", "d") == "log: a12.5b, 3c d" );
+	CHECK( concat_into<sep::plus>(s, 4, 5) == "log: a12.5b, 3c d4 + 5" );
+
+	s.clear();
+	s.reserve(64);
+	auto capacity = s.capacity();
+	const char* data = s.data();
+	for (int i = 0; i < 100; i++) {
+		s.clear();
+		concat_into(s, "message ", i, ' ', vector<int>{1,2,3});
+	}
+	CHECK( s == "message 99 123" );
+	CHECK( s.capacity() == capacity );
+	CHECK( s.data() == data );
+
+	vector<char> v{'>'};
+	concat_into(v, separator(","), 1, "two", string("three"));
+	CHECK( string(v.begin(), v.end()) == ">1,two,three" );
+
+	PushBackOnly p;
+	concat_into(p, "x", 1, UserDefinedType<char>("y"));
+	CHECK( p.text == "x1y" );
+
+	wstring w = L"w";
+	CHECK( concat_into(w, L"ide", 1) == L"wide1" );
+
+	stringstream failed;
+	failed.setstate(ios::failbit);
+	string untouched = "keep";
+	CHECK( concat_into(untouched, "lost", failed) == "keep" );
+}
+
+TEST_CASE( "concat_n, inline fixed capacity results", "concat_n" ) {
+	auto key = concat_n<32>(separator("."), "service", "eu-west", 42);
+	CHECK( key.str() == "service.eu-west.42" );
+	CHECK( key.size() == 18 );
+	CHECK( string(key.c_str()) == "service.eu-west.42" );
+	CHECK_FALSE( key.truncated() );
+
+	auto csv = concat_n<16, ','>(1, 2, vector<int>{3, 4});
+	CHECK( csv.str() == "1,2,3,4" );
+
+	auto cut = concat_n<5>("hello", " world", 123);
+	CHECK( cut.str() == "hello" );
+	CHECK( cut.truncated() );
+
+	CHECK( (concat_n<8, wchar_t>(L"w", 1).str() == L"w1") );
+	CHECK( concat_n<8>(UserDefinedType<char>("user")).str() == "user" );
+	CHECK( concat<' '>(concat_n<8>("in", 1), "out") == "in1 out" );
+
+	stringstream failed;
+	failed.setstate(ios::failbit);
+	CHECK( concat_n<8>("lost", failed).empty() );
+
+	// reused: the terminator follows every character, and a rollback keeps the flag the buffer already had
+	fixed_string<8> reused = concat_n<8>("abcdef");
+	reused.resize(0);
+	concat_into(reused, 'x');
+	CHECK( string(reused.c_str()) == "x" );
+	concat_into(reused, "12345678");
+	CHECK( reused.truncated() );
+	concat_into(reused, "lost", failed);
+	CHECK( reused.truncated() );
+	reused.resize(0);
+	concat_into(reused, "too long to fit", failed);
+	CHECK( reused.empty() );
+	CHECK_FALSE( reused.truncated() );
+}
+
+TEST_CASE( "Char-pack separators, every writer", "char_separator" ) {
+	CHECK( (concat<',', ' '>("a", vector<int>{1, 2}, make_pair('b', 3.5))) == "a, 1, 2, b, 3.5" );
+	CHECK( concat<';'>(make_tuple(1, "x"), UserDefinedType<char>("u")) == "1;x;u" );
+	CHECK( concat<','>(setw(3), 1, 2) == "  1,2" );
+
+	ostringstream host;
+	CHECK( (concat<'-', '>'>(host, 1, 2, "three")) == "1->2->three" );
+	ostringstream single;
+	CHECK( concat<'|'>(single, 'a', "b", 3) == "a|b|3" );
+}
+
+template <typename T>
+void check_integer_limits() {
+	T values[] = { numeric_limits<T>::min(), numeric_limits<T>::max(), T(0), T(9), T(10), T(99), T(100), T(101),
+	               T(numeric_limits<T>::max() / 10), T(numeric_limits<T>::min() / 10), T(numeric_limits<T>::min() + 1) };
+	for (T value : values) {
+		ostringstream stream;
+		stream << value;
+		const string expected = stream.str();
+		CHECK( concat(value) == expected );
+		CHECK( concat<wchar_t>(value) == wstring(expected.begin(), expected.end()) );
+	}
+}
+
+TEST_CASE( "Integer fast path, same text as num_put", "integers" ) {
+	check_integer_limits<short>();
+	check_integer_limits<unsigned short>();
+	check_integer_limits<int>();
+	check_integer_limits<unsigned>();
+	check_integer_limits<long>();
+	check_integer_limits<unsigned long>();
+	check_integer_limits<long long>();
+	check_integer_limits<unsigned long long>();
+	for (long long i = -100000; i <= 100000; i += 7) CHECK( concat(i) == to_string(i) );
+}
+
+TEST_CASE( "Roundtrip manipulator, shortest exact floating point text", "roundtrip" ) {
+	CHECK( concat<' '>(roundtrip, 0.1, 1.0/3.0, 2.0, -0.0, 1e21, 5e-324, 0.0001, 0.00001)
+			== "0.1 0.3333333333333333 2 -0 1e+21 5e-324 0.0001 1e-05" );
+	CHECK( concat<' '>(roundtrip, 0.1f, 16777216.0f, 1.7976931348623157e308) == "0.1 16777216 1.7976931348623157e+308" );
+	CHECK( concat<' '>(roundtrip, 1.0/3.0, noroundtrip, 1.0/3.0) == "0.3333333333333333 0.333333" );
+	CHECK( concat(separator(","), roundtrip, vector<double>{0.5, 0.25}, make_pair(1e-7, 12345678.9)) == "0.5,0.25,1e-07,12345678.9" );
+	CHECK( concat(roundtrip, setw(6), 0.5) == "   0.5" );
+
+	mt19937_64 random(42);
+	for (int i = 0; i < 10000; i++) {
+		const double value = uniform_real_distribution<double>(-1e12, 1e12)(random) / (1 + random() % 1000000);
+		CHECK( strtod(concat(roundtrip, value).c_str(), nullptr) == value );
+	}
+
+	ostringstream host;
+	CHECK( concat<' '>(host, roundtrip, 0.1, 2.5) == "0.1 2.5" );
+	CHECK( concat(host, 1.0/3.0) == "0.1 2.50.3333333333333333" );
+}
+
+struct CountedType {
+	static int writes;
+	friend ostream& operator<<(ostream& out, const CountedType&) {
+		writes++;
+		return out << "counted";
+	}
+};
+int CountedType::writes = 0;
+
+TEST_CASE( "concat_lazy, deferred materialization", "concat_lazy" ) {
+	vector<int> v = {1, 2, 3};
+	CountedType counted;
+	CountedType::writes = 0;
+	auto discarded = concat_lazy(separator(" "), "never", counted, v);
+	(void)discarded;
+	CHECK( CountedType::writes == 0 );
+
+	auto e = concat_lazy(separator(", "), "a", 1, v, counted);
+	CHECK( e.size() == string("a, 1, 1, 2, 3, counted").size() );
+	CHECK( e.str() == "a, 1, 1, 2, 3, counted" );
+	string s = e;
+	CHECK( s == "a, 1, 1, 2, 3, counted" );
+
+	string buffer = ">";
+	CHECK( e.append_to(buffer) == ">a, 1, 1, 2, 3, counted" );
+
+	ostringstream out;
+	out << "[" << concat_lazy<','>(1, "b", make_tuple(2.5, 'c')) << "]" << 3.14159;
+	CHECK( out.str() == "[1,b,2.5,c]3.14159" );
+
+	ostringstream flags;
+	flags << concat_lazy(hex, 255, setprecision(2), 1.0/3.0) << ' ' << 255 << ' ' << 1.0/3.0;
+	CHECK( flags.str() == "ff0.33 255 0.333333" );
+
+	// the format state of the stream doesn't change the text, and is given back afterwards
+	ostringstream formatted;
+	formatted << hex << fixed << setprecision(2) << setfill('*') << escape::json << roundtrip;
+	formatted << concat_lazy(255, ' ', 1.5, ' ', 1.0/3.0, "\"x\"") << ' ' << 255 << ' ' << 1.5 << ' ' << 0.1;
+	CHECK( formatted.str() == "255 1.5 0.333333\"x\" ff 1.50 0.10" );
+	CHECK( (formatted.flags() & ios_base::basefield) == ios_base::hex );
+	CHECK( formatted.fill() == '*' );
+
+	ostringstream padded;
+	padded << setw(6) << concat_lazy("ab", 1) << '|';
+	CHECK( padded.str() == "   ab1|" );
+
+	CHECK( (concat_lazy<wchar_t>(L"w", 2).str() == L"w2") );
+	CHECK( concat_lazy<sep::comma>("x", 1, v).str() == concat<sep::comma>("x", 1, v) );
+	ostringstream lines;
+	lines << concat_lazy<endl>("a", 1, 2.5);
+	CHECK( lines.str() == "a\n1\n2.5" );
+	CHECK( concat_lazy<endl>("a", 1).size() == 3 );
+
+	// temporaries are moved into the expression, so it can outlive them
+	auto moved = concat_lazy<' '>(string(100, 't'), vector<int>{ 4, 5 }, 6);
+	CHECK( moved.str() == string(100, 't') + " 4 5 6" );
+}
+
+TEST_CASE( "Stream types, guest buffers read in place", "stream_in_place" ) {
+	istringstream partially_read("first second");
+	string word;
+	partially_read >> word;
+	CHECK( concat<' '>("in:", partially_read) == "in: first second" );
+
+	stringstream rewritten;
+	rewritten << "abcdef";
+	rewritten.seekp(2);
+	rewritten << "X";
+	CHECK( concat(static_cast<const stringstream&>(rewritten)) == rewritten.str() );
+
+	ostringstream rewound; // the tail past the put position is still part of str()
+	rewound << "hello world";
+	rewound.seekp(0);
+	rewound << "J";
+	CHECK( concat(static_cast<const ostringstream&>(rewound)) == "Jello world" );
+	CHECK( concat_deferred("<", static_cast<const ostringstream&>(rewound), ">").str() == "<Jello world>" );
+	CHECK( concat(escape::json, static_cast<const ostringstream&>(rewound)) == "Jello world" );
+
+	ostringstream big;
+	for (int i = 0; i < 100000; i++) big << i;
+	const string expected = big.str();
+	CHECK( concat("", big) == expected );
+	CHECK( concat_impl_size_element<char>(static_cast<const char*>(nullptr), big) == expected.size() );
+
+	ostringstream host;
+	host << "host";
+	CHECK( concat(host, big).size() == 4 + expected.size() );
+
+	stringstream padded;
+	padded << "ab";
+	CHECK( concat(setw(4), padded, "|") == "  ab|" );
+}
+
+TEST_CASE( "String ranges, joined without per element dispatch", "string_join" ) {
+	vector<string> ids;
+	for (int i = 0; i < 100000; i++) ids.push_back(to_string(i));
+	ostringstream expected;
+	for (size_t i = 0; i < ids.size(); i++) expected << (i ? ", " : "") << ids[i];
+	const string joined = expected.str();
+	CHECK( concat(separator(", "), ids) == joined );
+	CHECK( (concat<',', ' '>(ids) == joined) );
+	CHECK( concat<sep::comma>(ids).size() == joined.size() );
+
+	const array<const char*, 4> cstrs = {{ "a", nullptr, "c", "" }};
+	CHECK( concat<'|'>(cstrs) == "a||c|" );
+	CHECK( concat(cstrs) == "ac" );
+	CHECK( concat(separator(static_cast<const char*>(nullptr)), cstrs) == "ac" );
+
+	const vector<wstring> wide = { L"x", L"y" };
+	CHECK( concat<wchar_t>(separator(L"-"), wide) == L"x-y" );
+
+	const vector<vector<string>> nested = { { "a", "b" }, {}, { "c" } };
+	CHECK( concat<','>(nested) == "a,b,,c" );
+
+	CHECK( concat<','>(setw(3), vector<string>{ "a", "b" }) == "  a,b" );
+	CHECK( concat<endl>(vector<string>{ "a", "b" }) == "a\nb" );
+}
+
+TEST_CASE( "Parallel join, same output as the serial one", "parallel" ) {
+	vector<int> ints;
+	vector<double> doubles;
+	vector<string> words;
+	for (int i = 0; i < 100000; i++) {
+		ints.push_back(i * 7919 - 400000);
+		doubles.push_back(i / 7.0);
+		words.push_back(to_string(i));
+	}
+	CHECK( concat<','>(parallel(ints, 4)) == concat<','>(ints) );
+	CHECK( concat(separator(", "), parallel(doubles, 3)) == concat(separator(", "), doubles) );
+	CHECK( concat<sep::comma>(parallel(words, 5)) == concat<sep::comma>(words) );
+	CHECK( concat(parallel(ints, 4), parallel(ints, 1)) == concat(ints, ints) );
+	CHECK( concat<','>(parallel(vector<int>(), 4)) == "" );
+	CHECK( concat<','>(parallel(vector<int>{ 1, 2, 3 })) == "1,2,3" );
+
+	CHECK( concat<' '>(hex, parallel(ints, 4)) == concat<' '>(hex, ints) );
+	CHECK( concat<' '>(roundtrip, parallel(doubles, 4), 0.1) == concat<' '>(roundtrip, doubles, 0.1) );
+	CHECK( concat<' '>(setw(12), parallel(ints, 4)) == concat<' '>(setw(12), ints) );
+	CHECK( concat(setfill('*'), UserDefinedType<char>("u"), parallel(ints, 4)) == concat(setfill('*'), UserDefinedType<char>("u"), ints) );
+
+	list<UserDefinedType<char>> users(50000, UserDefinedType<char>("user"));
+	CHECK( concat<'|'>(parallel(users, 4)) == concat<'|'>(users) );
+
+	// the format changes inside the range, so every chunk depends on the previous one
+	vector<pair<int, ios_base& (*)(ios_base&)>> switching;
+	for (int i = 0; i < 50000; i++) switching.push_back(make_pair(i, i % 3 ? &hex : &dec));
+	CHECK( concat<' '>(parallel(switching, 4)) == concat<' '>(switching) );
+
+	ostringstream host;
+	concat<','>(host, parallel(ints, 4));
+	CHECK( host.str() == concat<','>(ints) );
+
+	// temporaries are moved into the range, so a lazy expression can keep them
+	auto lazy = concat_lazy<','>(parallel(vector<int>(ints), 4));
+	CHECK( lazy.str() == concat<','>(ints) );
+	CHECK( concat_alloc(allocator<char>(), separator(","), parallel(ints, 4)) == concat<','>(ints) );
+}
+
+TEST_CASE( "Integer ranges, digits written in place", "integer_join" ) {
+	vector<int64_t> ids;
+	ids.push_back(numeric_limits<int64_t>::min());
+	ids.push_back(numeric_limits<int64_t>::max());
+	for (int64_t i = -1000; i <= 1000; i += 7) ids.push_back(i * i * i);
+	ostringstream expected;
+	for (size_t i = 0; i < ids.size(); i++) expected << (i ? "," : "") << ids[i];
+	CHECK( concat<','>(ids) == expected.str() );
+	CHECK( concat(separator(","), ids) == expected.str() );
+
+	const array<uint16_t, 4> shorts = {{ 0, 9, 10, 65535 }};
+	CHECK( concat<' '>(shorts) == "0 9 10 65535" );
+	CHECK( concat<wchar_t>(separator(L", "), list<unsigned>{ 4294967295u, 0u }) == L"4294967295, 0" );
+	CHECK( concat(vector<long>{ -1, 2, -3 }) == "-12-3" );
+
+	vector<char> chars;
+	concat_into(chars, separator("|"), vector<int>{ 10, -20, 30 });
+	CHECK( string(chars.begin(), chars.end()) == "10|-20|30" );
+	CHECK( concat_n<6>(separator("|"), vector<int>{ 10, -20, 30 }).str() == "10|-20" );
+
+	CHECK( concat<','>(vector<bool>{ true, false }) == "1,0" );
+	CHECK( concat<','>(vector<signed char>{ 'a', 'b' }) == "a,b" );
+	CHECK( concat<','>(hex, vector<int>{ 255, 16 }) == "ff,10" );
+}
+
+struct FormatChanger {
+	friend ostream& operator<<(ostream& out, const FormatChanger&) {
+		out.imbue(locale::classic());
+		out.exceptions(ios::badbit);
+		out.iword(roundtrip_t::index()) = 1;
+		return out << hex << setfill('#') << 255;
+	}
+};
+
+struct Nested {
+	friend ostream& operator<<(ostream& out, const Nested&) {
+		return out << concat<'-'>(UserDefinedType<char>("in"), hex, 255);
+	}
+};
+
+TEST_CASE( "Pooled streams, nothing leaks between calls", "stream_pool" ) {
+	CHECK( concat(setfill('*'), setw(5), UserDefinedType<char>("a")) == "****a" );
+	CHECK( concat(setw(5), UserDefinedType<char>("a")) == "    a" );
+	CHECK( concat(boolalpha, UserDefinedType<char>("a"), true) == "atrue" );
+	CHECK( concat(UserDefinedType<char>("a"), true, 255) == "a1255" );
+	CHECK( concat(FormatChanger(), ' ', 255) == "ff ff" );
+	CHECK( concat(UserDefinedType<char>("a"), setw(3), 255, ' ', 1.0/3.0) == "a255 0.333333" );
+
+	// a user type can call concat from its own operator<<, with its own stream
+	CHECK( concat<' '>(UserDefinedType<char>("out"), Nested(), UserDefinedType<char>("out"), 255) == "out in-ff out 255" );
+
+	CHECK( concat<char16_t>(UserDefinedType<char16_t>(u"a"), UserDefinedType<char16_t>(u"b")) == u"ab" );
+	CHECK( concat<char16_t>(UserDefinedType<char16_t>(u"c")) == u"c" );
+
+	// a huge insertion doesn't keep its buffer in the pool
+	const string huge(100000, 'h');
+	CHECK( concat(UserDefinedType<char>(huge.c_str())) == huge );
+	auto stream = stream_pool<char>::local().acquire();
+	CHECK( stringbuf_access<char>::capacity(stream->rdbuf()) <= 4096 );
+	CHECK( concat(UserDefinedType<char>("small")) == "small" );
+	stream_pool<char>::local().release(move(stream));
+
+	// pooled streams follow std::locale::global like new ones
+	struct comma_point : numpunct<char> {
+		char do_decimal_point() const override { return ','; }
+	};
+	CHECK( concat(setprecision(3), 1.5) == "1.5" );
+	const locale previous = locale::global(locale(locale::classic(), new comma_point));
+	CHECK( concat(setprecision(3), 1.5) == "1,5" );
+	locale::global(previous);
+	CHECK( concat(setprecision(3), 1.5) == "1.5" );
+}
+
+template <typename T>
+struct ArenaAllocator { // hands out memory from a fixed block, and counts what was requested
+	typedef T value_type;
+
+	struct Arena {
+		char memory[1 << 16];
+		size_t used = 0, allocations = 0;
+	};
+	Arena* arena;
+
+	explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(reinterpret_cast<Arena*>(other.arena)) {}
+
+	T* allocate(size_t n) {
+		arena->allocations++;
+		T* p = reinterpret_cast<T*>(arena->memory + arena->used);
+		arena->used += (n * sizeof(T) + 15) / 16 * 16;
+		if (arena->used > sizeof(arena->memory)) throw bad_alloc();
+		return p;
+	}
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == reinterpret_cast<Arena*>(other.arena); }
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return !(*this == other); }
+};
+
+TEST_CASE( "concat_alloc, result built with the given allocator", "concat_alloc" ) {
+	ArenaAllocator<char>::Arena arena;
+	const ArenaAllocator<char> alloc(&arena);
+	const vector<int> v = { 1, 2, 3 };
+
+	auto result = concat_alloc(alloc, separator(", "), "text", v, 2.5, UserDefinedType<char>("user"));
+	static_assert(is_same<decltype(result), basic_string<char, char_traits<char>, ArenaAllocator<char>>>::value, "");
+	CHECK( result == "text, 1, 2, 3, 2.5, user" );
+	CHECK( result.get_allocator() == alloc );
+	CHECK( arena.allocations == 1 );
+	CHECK( (const char*)result.data() >= arena.memory );
+	CHECK( (const char*)result.data() <  arena.memory + sizeof(arena.memory) );
+
+	CHECK( (concat_alloc<',', ' '>(alloc, "a", 1) == "a, 1") );
+	CHECK( concat_alloc<sep::comma>(alloc, "a", 1) == "a, 1" );
+	CHECK( concat_alloc(alloc, "a", 1, 'c') == "a1c" );
+
+	ArenaAllocator<wchar_t>::Arena wide_arena;
+	CHECK( concat_alloc(ArenaAllocator<wchar_t>(&wide_arena), separator(L" "), L"wide", 1) == L"wide 1" );
+}
+
+string read_all(int fd) {
+	string text;
+	char buffer[4096];
+	for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0; ) text.append(buffer, n);
+	return text;
+}
+
+TEST_CASE( "concat_write, gathered output to a file", "concat_write" ) {
+	const string long_text(3000, 'x');
+	const vector<string> columns = { string(1000, 'a'), "b", string(700, 'c') };
+	ostringstream guest;
+	guest << string(800, 'g');
+	const string expected = concat<' '>("GET", long_text, 200, columns, 1.5, UserDefinedType<char>("user"), static_cast<const ostringstream&>(guest));
+
+	int fds[2];
+	REQUIRE( pipe(fds) == 0 );
+	CHECK( concat_write<' '>(fds[1], "GET", long_text, 200, columns, 1.5, UserDefinedType<char>("user"), static_cast<const ostringstream&>(guest)) );
+	CHECK( concat_write(fds[1], separator(", "), 1, "two") );
+	CHECK( concat_write<sep::comma>(fds[1], 3, long_text) );
+	CHECK( concat_write(fds[1], '\n') );
+	close(fds[1]);
+	CHECK( read_all(fds[0]) == expected + "1, two" + "3, " + long_text + "\n" );
+	close(fds[0]);
+	CHECK( !concat_write(fds[1], "closed") );
+
+	// more segments than gather_buffer keeps, referenced text has to be moved to the scratch area
+	vector<string> many(100, string(600, 'm'));
+	FILE* file = tmpfile();
+	REQUIRE( file );
+	CHECK( concat_write<','>(file, many, 'z', long_text) );
+	rewind(file);
+	CHECK( read_all(fileno(file)) == concat<','>(many, 'z', long_text) );
+	fclose(file);
+
+	gather_buffer<char> buffer;
+	concat_into(buffer, "short", long_text, 7);
+	vector<const char*> texts;
+	buffer.for_each([&](const char* s, size_t) { texts.push_back(s); });
+	REQUIRE( texts.size() == 3 );
+	CHECK( texts[1] == long_text.data() );
+	buffer.resize(5);
+	CHECK( buffer.size() == 5 );
+	concat_into(buffer, "!");
+	string gathered;
+	buffer.for_each([&](const char* s, size_t n) { gathered.append(s, n); });
+	CHECK( gathered == "short!" );
+}
+
+TEST_CASE( "concat_log, many producers and one file", "concat_log" ) {
+	FILE* file = tmpfile();
+	REQUIRE( file );
+	const int threads = 4, messages = 2000;
+	size_t truncated = 0;
+	{
+		concat_log<64> log(fileno(file), 128);
+		vector<thread> producers;
+		for (int t = 0; t < threads; t++) {
+			producers.emplace_back([&log, t] {
+				for (int i = 0; i < messages; i++) {
+					while (!log.write<' '>("thread", t, "message", i)) this_thread::yield(); // full ring, retried
+				}
+			});
+		}
+		for (auto& producer : producers) producer.join();
+
+		CHECK( log.write(separator(", "), vector<int>{ 1, 2 }, UserDefinedType<char>("user"), 2.5) );
+		CHECK( log.write<sep::comma>("a", 'b') );
+		CHECK( log.write(string(100, 'x')) );
+		ostringstream failed;
+		failed.setstate(ios::failbit);
+		CHECK( !log.write("nothing is written", static_cast<const ostringstream&>(failed)) );
+		truncated = log.truncated();
+	}
+	CHECK( truncated == 1 );
+
+	rewind(file);
+	istringstream lines(read_all(fileno(file)));
+	fclose(file);
+	vector<int> next(threads, 0);
+	string line;
+	int count = 0;
+	while (count < threads * messages && getline(lines, line)) {
+		int t, i;
+		REQUIRE( sscanf(line.c_str(), "thread %d message %d", &t, &i) == 2 );
+		CHECK( i == next[t]++ ); // each producer keeps its order
+		count++;
+	}
+	CHECK( count == threads * messages );
+
+	getline(lines, line);
+	CHECK( line == "1, 2, user, 2.5" );
+	getline(lines, line);
+	CHECK( line == "a, b" );
+	getline(lines, line);
+	CHECK( line == string(63, 'x') );
+	CHECK( !getline(lines, line) );
+}
+
+struct ThrowingType {
+	friend ostream& operator<<(ostream&, const ThrowingType&) { throw runtime_error("unwritable"); }
+};
+
+TEST_CASE( "concat_log, a parameter that throws", "concat_log_throw" ) {
+	FILE* file = tmpfile();
+	REQUIRE( file );
+	{
+		concat_log<64> log(fileno(file), 4);
+		CHECK( log.write<' '>("before") );
+		CHECK_THROWS_AS( log.write<' '>("lost", ThrowingType()), runtime_error );
+		for (int i = 0; i < 8; i++) {
+			while (!log.write<' '>("after", i)) this_thread::yield(); // the ring goes round past the thrown slot
+		}
+	} // doesn't wait for the thrown slot forever
+
+	rewind(file);
+	const string text = read_all(fileno(file));
+	fclose(file);
+	CHECK( text == "before\nafter 0\nafter 1\nafter 2\nafter 3\nafter 4\nafter 5\nafter 6\nafter 7\n" );
+}
+
+TEST_CASE( "concat_deferred, parameters copied now and formatted later", "concat_deferred" ) {
+	string text = "text";
+	char buffer[] = "buffer";
+	vector<const char*> pointers = { "p1", "p2" };
+	map<string, vector<int>> nested = { { "k", { 1, 2 } } };
+	ostringstream guest;
+	guest << "guest";
+	char separator_text[] = ", ";
+
+	auto record = concat_deferred(separator(separator_text), text, buffer, pointers, nested, make_tuple(1, string("t")),
+	                              static_cast<const ostringstream&>(guest), UserDefinedType<char>("user"), 2.5, 'c');
+	const string expected = "text, buffer, p1, p2, k, 1, 2, 1, t, guest, user, 2.5, c";
+
+	text = "changed";
+	strcpy(buffer, "BUFFER");
+	pointers.clear();
+	nested.clear();
+	guest.str("");
+	strcpy(separator_text, "--");
+	CHECK( record.str() == expected );
+
+	// records of different parameters share a type, so they can share a queue and be formatted on another thread
+	vector<concat_record<>> queue;
+	queue.push_back(move(record));
+	queue.push_back(concat_deferred<' '>(hex, 255, setprecision(3), 1.0 / 3.0));
+	queue.push_back(concat_deferred(string("moved"), 1));
+	string formatted;
+	thread consumer([&] {
+		for (const auto& r : queue) r.append_to(formatted) += '\n';
+	});
+	consumer.join();
+	CHECK( formatted == expected + "\nff 0.333\nmoved1\n" );
+
+	ostringstream out;
+	out << queue[1] << ' ' << 255;
+	CHECK( out.str() == "ff 0.333 255" );
+
+	// records too big to be kept inline are allocated, and move the same way
+	const string word = "word";
+	auto big = concat_deferred(separator("-"), word, word, word, word, word, word, word, word);
+	auto small = concat_deferred(separator("-"), word, 1);
+	vector<concat_record<>> moved;
+	moved.push_back(move(big));
+	moved.push_back(move(small));
+	moved.push_back(concat_deferred<' '>(3));
+	CHECK( moved[0].str() == "word-word-word-word-word-word-word-word" );
+	CHECK( moved[1].str() == "word-1" );
+	CHECK( big.str() == "" );
+
+	// the format state of the stream doesn't change the text
+	ostringstream hexed;
+	hexed << hex << setprecision(2) << concat_deferred<' '>(255, 1.0 / 3.0) << ' ' << 255;
+	CHECK( hexed.str() == "255 0.333333 ff" );
+
+	ostringstream failed;
+	failed.setstate(ios::failbit);
+	auto failing = concat_deferred("a", static_cast<const ostringstream&>(failed));
+	CHECK( failing.str() == "" );
+	ostringstream file;
+	file << failing << concat_deferred("next", 1);
+	CHECK( file.good() );
+	CHECK( file.str() == "next1" );
+	CHECK( concat_record<>().str() == "" );
+	CHECK( concat_deferred<wchar_t>(L"w", 1).str() == L"w1" );
+}
+
+TEST_CASE( "concat_c, literal parameters joined at compile time", "concat_c" ) {
+	constexpr auto prefix = concat_c<'.'>("app", "http", "requests");
+	static_assert(prefix.size() == 17 && prefix[3] == '.', "concat_c must be a constant expression");
+	CHECK( string(prefix.c_str()) == "app.http.requests" );
+	CHECK( prefix.str() == concat<'.'>("app", "http", "requests") );
+
+	constexpr auto sql = concat_c("SELECT * FROM users LIMIT ", integral_constant<int, 50>(), ' ', "OFFSET ",
+	                              integral_constant<long long, -9223372036854775807LL - 1>(), ';');
+	CHECK( sql.str() == "SELECT * FROM users LIMIT 50 OFFSET -9223372036854775808;" );
+
+	constexpr auto mixed = concat_c<sep::comma>(prefix, integral_constant<unsigned long long, 18446744073709551615ULL>(),
+	                                            integral_constant<char, 'x'>(), true_type(), integral_constant<int, 0>());
+	CHECK( mixed.str() == "app.http.requests, 18446744073709551615, x, 1, 0" );
+	CHECK( concat_c("").empty() );
+
+	// a char array that isn't a literal would keep the bytes strlen doesn't see, so it is refused
+	char buffer[16] = "abc";
+	CHECK_THROWS_AS( concat_c(buffer), invalid_argument );
+	char full[4] = "abc";
+	CHECK( concat_c(full).str() == concat(full) );
+
+	// the result is a string parameter of concat too
+	ostringstream out;
+	out << prefix;
+	CHECK( out.str() == "app.http.requests" );
+	CHECK( concat<' '>(prefix, 200) == "app.http.requests 200" );
+}
+
+TEST_CASE( "concat_interned, repeated parameters formatted once", "concat_interned" ) {
+	concat_cache<> cache(2, 1);
+	string service = "api";
+	auto first = concat_interned(cache, separator("."), service, "eu", 42, 2.5);
+	auto again = concat_interned(cache, separator("."), service, "eu", 42, 2.5);
+	CHECK( *first == "api.eu.42.2.5" );
+	CHECK( first == again );
+	CHECK( cache.hits() == 1 );
+	CHECK( cache.misses() == 1 );
+
+	// the key is made of the values and their kinds, not of the text they print
+	service = "web";
+	CHECK( *concat_interned(cache, separator("."), service, "eu", 42, 2.5) == "web.eu.42.2.5" );
+	CHECK( *concat_interned<'.'>(cache, 49) == "49" );
+	CHECK( *concat_interned<'.'>(cache, '1') == "1" );
+	CHECK( *concat_interned<sep::comma>(cache, 1u, true, 1.0f) == "1, 1, 1" );
+	CHECK( cache.size() == 2 );
+	CHECK( cache.evictions() == 3 );
+
+	// the clock spares the results read since its last pass
+	cache.clear();
+	auto kept = concat_interned(cache, "kept");
+	concat_interned(cache, "evicted");
+	concat_interned(cache, "kept");
+	concat_interned(cache, "new");
+	CHECK( concat_interned(cache, "kept") == kept );
+	CHECK( *concat_interned(cache, "evicted") == "evicted" );
+
+	concat_cache<> shared(64, 4);
+	vector<thread> threads;
+	vector<int> wrong(4, 0);
+	for (int t = 0; t < 4; t++) threads.emplace_back([&, t] {
+		for (int i = 0; i < 2000; i++) {
+			const int metric = (i * 7 + t) % 100;
+			if (*concat_interned<'.'>(shared, "service", "region", metric) != concat<'.'>("service", "region", metric))
+				wrong[t]++;
+		}
+	});
+	for (auto& t : threads) t.join();
+	CHECK( wrong == vector<int>(4, 0) );
+	CHECK( (shared.hits() + shared.misses()) == 8000 );
+	CHECK( shared.size() <= shared.capacity() );
+
+	concat_cache<wchar_t> wide;
+	CHECK( *concat_interned(wide, separator(L"-"), L"w", 1) == L"w-1" );
+}
+
+TEST_CASE( "UTF transcoding, text of another char type", "transcoding" ) {
+	CHECK( concat<char>(wstring(L"wé"), u"€", U"\U0001F600", u16string(u"s")) == "w\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80s" );
+	CHECK( concat<char16_t>("h\xc3\xa9llo ", U"\U0001F600") == u"héllo \U0001F600" );
+	CHECK( concat<char32_t>(separator(U", "), "a", u"\U0001F600", L"w") == U"a, \U0001F600, w" );
+	CHECK( concat<wchar_t>("narrow ", 1) == L"narrow 1" );
+
+	// long ASCII runs take the block path, whatever is around them takes the code point path
+	string mixed;
+	for (int i = 0; i < 100; i++) mixed += concat("ascii run ", i, " \xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80 ");
+	CHECK( concat<char>(concat<char16_t>(mixed)) == mixed );
+	CHECK( concat<char>(concat<char32_t>(mixed)) == mixed );
+	CHECK( concat<char16_t>(concat<char32_t>(mixed)) == concat<char16_t>(mixed) );
+
+	// broken sequences become U+FFFD
+	CHECK( concat<char16_t>("a\xff" "b\xc3") == u"a�b�" );
+	CHECK( concat<char16_t>("\xe2\x82" "x") == u"�x" );
+	CHECK( concat<char>(u"\xd800x") == "\xef\xbf\xbdx" );
+	CHECK( concat<char>(U"\x110000") == "\xef\xbf\xbd" );
+
+	// containers, host streams, and format flags
+	CHECK( concat<char>(separator(", "), vector<u16string>{ u"b", u"c" }) == "b, c" );
+	CHECK( concat<' '>(setw(3), u"x", 'y') == "  x y" );
+	ostringstream host;
+	concat(host, u"hé", 1);
+	CHECK( host.str() == "h\xc3\xa9" "1" );
+	CHECK( concat_lazy<char>(u"lazy").size() == 4 );
+	CHECK( concat_n<4>(u"fixed").str() == "fixe" );
+}
+
+TEST_CASE( "escape::json, parameters written as JSON string contents", "escape_json" ) {
+	CHECK( concat(escape::json, "say \"hi\"\n", '\t', string("back\\slash"), 42) == "say \\\"hi\\\"\\n\\tback\\\\slash42" );
+	CHECK( concat(escape::json, "\b\f\r\x01\x1f\x7f") == "\\b\\f\\r\\u0001\\u001f\x7f" );
+	CHECK( concat(escape::json, "caf\xc3\xa9") == "caf\xc3\xa9" );
+
+	// clean spans longer than a vector register, with specials at every offset
+	for (size_t i = 0; i < 70; i++) {
+		string field(70, 'x');
+		field[i] = '"';
+		CHECK( concat(escape::json, field) == field.substr(0, i) + "\\\"" + field.substr(i + 1) );
+	}
+
+	// separators are structure, they are not escaped. escape::none ends the mode
+	CHECK(( concat<'"', ':', '"'>(escape::json, "k\"", "v\"") == "k\\\"\":\"v\\\"" ));
+	CHECK( concat<','>(escape::json, vector<string>{ "a\"", "b" }, escape::none, "\"raw\"") == "a\\\",b,\"raw\"" );
+	CHECK( concat(escape::json, UserDefinedType<char>("user\"type")) == "user\\\"type" );
+	CHECK( concat(escape::json, u"utf16 \"") == "utf16 \\\"" );
+	CHECK( concat<char16_t>(escape::json, u"w\"\x01") == u"w\\\"\\u0001" );
+
+	ostringstream guest;
+	guest << "guest\"";
+	CHECK( concat(escape::json, static_cast<const ostringstream&>(guest)) == "guest\\\"" );
+
+	ostringstream host;
+	concat(host, escape::json, "h\"", '"', string("s\\"), static_cast<const ostringstream&>(guest));
+	CHECK( host.str() == "h\\\"\\\"s\\\\guest\\\"" );
+
+	ostringstream lazy;
+	lazy << concat_lazy(escape::json, "lazy\"") << "\"";
+	CHECK( lazy.str() == "lazy\\\"\"" );
+}
+
+TEST_CASE( "escape::csv and escape::tsv, parameters written as RFC 4180 fields", "escape_csv" ) {
+	CHECK( concat<','>(escape::csv, "plain", "a,b", 1, "q\"x", "l\r\n") == "plain,\"a,b\",1,\"q\"\"x\",\"l\r\n\"" );
+	CHECK( concat<','>(escape::csv, "\"", '"', "\"\"") == "\"\"\"\",\"\"\"\",\"\"\"\"\"\"" );
+	CHECK(( concat<','>(escape::csv, vector<string>{ "x\ny", "z" }, make_tuple("t,", 2)) == "\"x\ny\",z,\"t,\",2" ));
+	CHECK( concat<'\t'>(escape::tsv, "a,b", "c\td", escape::none, "e\tf") == "a,b\t\"c\td\"\te\tf" );
+
+	// fields longer than a vector register, with the first special and a quote at every offset
+	for (size_t i = 0; i < 70; i++) {
+		string field(70, 'x');
+		field[i] = ',';
+		field[69 - i] = '"';
+		string quoted = field;
+		quoted.replace(69 - i, 1, "\"\"");
+		CHECK( concat(escape::csv, field) == "\"" + quoted + "\"" );
+	}
+
+	CHECK( concat(escape::csv, UserDefinedType<char>("user,type")) == "\"user,type\"" );
+	CHECK( concat(escape::csv, u"utf,16") == "\"utf,16\"" );
+	CHECK( concat<char16_t>(escape::csv, "w\"") == u"\"w\"\"\"" );
+
+	ostringstream host;
+	concat<','>(host, escape::csv, "h,", string("s\""), 3);
+	CHECK( host.str() == "\"h,\",\"s\"\"\",3" );
+
+	ostringstream lazy;
+	lazy << concat_lazy(escape::tsv, "lazy\t") << "\t";
+	CHECK( lazy.str() == "\"lazy\t\"\t" );
+}
+
+TEST_CASE( "split and unconcat, the inverse of concat", "split" ) {
+	vector<string> tokens;
+	for (auto token : split("a,bb,,c", separator(","))) tokens.push_back(token.str());
+	CHECK(( tokens == vector<string>{ "a", "bb", "", "c" } ));
+
+	CHECK( concat(separator("|"), split(string("x, y, z"), separator(", "))) == "x|y|z" );
+
+	const string fields = "first,second";
+	auto it = split(fields, separator(",")).begin(); // the range is gone, the text is not
+	CHECK( *it == string_ref<>("first") );
+	CHECK( *++it == string_ref<>("second") );
+	CHECK( ++it == split_range<>::iterator() );
+	CHECK( concat<'|'>(split<',', ' '>("x, y, z")) == "x|y|z" );
+	CHECK( concat<'|'>(split<','>("")) == "" );
+	CHECK( concat<'|'>(split<','>(",")) == "|" );
+	CHECK( concat<'|'>(split(static_cast<const char*>(nullptr), separator(","))) == "" );
+	CHECK( concat<'|'>(split(string(), separator(","))) == "" );
+	CHECK( concat<'|'>(split("no separator", separator(""))) == "no separator" );
+	CHECK( concat<char16_t>(separator(u"|"), split(u"a::b", separator(u"::"))) == u"a|b" );
+
+	// long texts, with the separator at every offset and candidates that only match its first and last characters
+	for (size_t i = 0; i < 70; i++) {
+		string text(70, 'x');
+		text.replace(i, 3, "<->");
+		text.insert(0, "<x>");
+		size_t count = 0;
+		for (auto token : split(text, separator("<->"))) {
+			count++;
+			CHECK( token.str().find("<->") == string::npos );
+		}
+		CHECK( count == 2 );
+	}
+
+	const string line = concat<','>(-42, 3.25, "name", true, 'c', 18446744073709551615ull);
+	auto values = unconcat<int, double, string, bool, char, unsigned long long>(line, separator(","));
+	CHECK(( values == make_tuple(-42, 3.25, string("name"), true, 'c', 18446744073709551615ull) ));
+
+	auto refs = unconcat<string_ref<>, short>("key=-32768", separator("="));
+	CHECK( get<0>(refs) == string_ref<>("key") );
+	CHECK( get<1>(refs) == -32768 );
+	CHECK( get<0>(unconcat<double>(concat(roundtrip, 0.1), separator(","))) == 0.1 );
+
+	CHECK_THROWS_AS( (unconcat<int, int>("1", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<int>("1,2", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<int>("1x", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<int>("", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<unsigned>("-1", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<double>(" 1", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<double>("+1", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<double>("0x10", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<double>("1e", separator(","))), invalid_argument );
+	CHECK_THROWS_AS( (unconcat<double>(".", separator(","))), invalid_argument );
+	CHECK( get<0>(unconcat<double>("-.5e+1", separator(","))) == -5 );
+	CHECK( get<0>(unconcat<double>(concat(1.0 / 0.0), separator(","))) == 1.0 / 0.0 );
+
+	// the text concat writes is read back whatever LC_NUMERIC is
+	REQUIRE( set_comma_numeric_locale() );
+	CHECK( get<0>(unconcat<double>("1.5", separator(";"))) == 1.5 );
+	CHECK( get<0>(unconcat<double>(concat(-2.5e-7), separator(";"))) == -2.5e-7 );
+	CHECK_THROWS_AS( (unconcat<double>("1,5", separator(";"))), invalid_argument );
+	setlocale(LC_NUMERIC, "C");
+	CHECK_THROWS_AS( (unconcat<short>("32768", separator(","))), out_of_range );
+	CHECK_THROWS_AS( (unconcat<double>("1e999", separator(","))), out_of_range );
+}
+
+TEST_CASE( "concat_hash and concat_equals, keys that are never built", "concat_hash" ) {
+	// XXH64 reference values
+	CHECK( concat_hash("") == 0xef46db3751d8e999ull );
+	CHECK( concat_hash("abc") == 0x44bc2cf5ad770999ull );
+	CHECK( concat_hash("Nobody inspects", " the spammish repetition") == 0xfbcea83c8a378bf1ull );
+
+	// the same bytes however they are split, on both sides of a stripe
+	for (size_t n = 0; n < 100; n++) {
+		const string text = concat(separator("."), n, string(n, 'k'), -1.5, 'c', vector<int>{ 1, 2 }, UserDefinedType<char>("user"));
+		CHECK( concat_hash(separator("."), n, string(n, 'k'), -1.5, 'c', vector<int>{ 1, 2 }, UserDefinedType<char>("user")) == concat_hash(text) );
+		CHECK( concat_equals(text, separator("."), n, string(n, 'k'), -1.5, 'c', vector<int>{ 1, 2 }, UserDefinedType<char>("user")) );
+		CHECK_FALSE( concat_equals(text, separator("."), n, string(n, 'k'), -1.5, 'c', vector<int>{ 1, 3 }, UserDefinedType<char>("user")) );
+	}
+
+	CHECK( concat_hash<','>("a", 1) == concat_hash("a,1") );
+	CHECK( concat_hash<sep::comma>("a", 1) == concat_hash("a, 1") );
+	CHECK( concat_hash<char16_t>(u"wide", 1) == concat_hash<char16_t>(u"wide1") );
+	CHECK( concat_hash<char16_t>(u"wide") != concat_hash("wide") );
+
+	CHECK( concat_equals<','>("a,1", "a", 1) );
+	CHECK( concat_equals<sep::comma>(string("a, 1"), "a", 1) );
+	CHECK( concat_equals<char16_t>(u"wide1", u"wide", 1) );
+	CHECK_FALSE( concat_equals("a1", "a", 1, 2) );  // longer than the candidate
+	CHECK_FALSE( concat_equals("a12", "a", 1) );    // shorter than the candidate
+	CHECK_FALSE( concat_equals("b1", "a", 1) );
+
+	ostringstream failed;
+	failed << "x";
+	failed.setstate(ios::failbit);
+	const ostringstream& f = failed;
+	CHECK( concat("a", f) == "" ); // a failed parameter leaves the result empty
+	CHECK( concat_equals("", "a", f) );
+	CHECK_FALSE( concat_equals("a", "a", f) );
+	CHECK( concat_hash("a", f) == concat_hash("") );
+}